@@ -7,6 +7,12 @@
 #include "Sphere.h"
 #include "WICTextureLoader.h"
 #include "LSpecies.h"
+#include "LSpeciesLibrary.h"
+#ifdef LSYSTEM_BENCHMARK
+#include "LScan.h"
+#include <chrono>
+#include <thread>
+#endif
 #include <iostream>
 #include <cstdlib>
 #include <time.h>
@@ -35,7 +41,11 @@ Game::Game(HINSTANCE hInstance)
 		true),			   // Show extra stats (fps) in title bar?
 	vsync(false)
 {
-#if defined(DEBUG) || defined(_DEBUG)
+	segmentMesh = nullptr;
+	leafMesh = nullptr;
+	instancedTreeSegments = nullptr;
+	instancedTreeLeaves = nullptr;
+#if defined(DEBUG) || defined(_DEBUG) || defined(LSYSTEM_BENCHMARK)
 	// Do we want a console window?  Probably only in debug mode
 	CreateConsoleWindow(500, 120, 32, 120);
 	printf("Console window created successfully.  Feel free to printf() here.\n");
@@ -52,12 +62,26 @@ Game::~Game()
 	delete bark;
 	delete grass;
 	delete aluminum;
+	delete instancedBark;
+	delete leaves;
 	delete cubeMesh;
 	delete sphereMesh;
 	delete planeMesh;
 	delete skyBox;
-	delete tree1Mesh;
-	delete tree2Mesh;
+	for (const std::vector<Mesh*>& details : tree1Meshes) {
+		for (Mesh* mesh : details) {
+			delete mesh;
+		}
+	}
+	for (const std::vector<Mesh*>& details : tree2Meshes) {
+		for (Mesh* mesh : details) {
+			delete mesh;
+		}
+	}
+	delete instancedTreeSegments;
+	delete instancedTreeLeaves;
+	delete segmentMesh;
+	delete leafMesh;
 	delete camTransform;
 }
 
@@ -98,17 +122,46 @@ void Game::Init()
 }
 
 void Game::TestLSystem() {
-	LSpecies* species1 = new LSpecies([this](std::string rule) {
-		this->replaceAll(rule, "X", "F[-#$[FX]<[FX]<[FX]]");
-		return rule;
-		}, std::string("X"), DirectX::XM_PI/6, 2*DirectX::XM_PI/3, 0.3f, 0.7f, 1.f, 0.8f);
-	std::string rule = species1->Grow(4);
-	tree1Mesh = species1->Build(rule, device, context);
-	LSpecies* species2 = new LSpecies([this](std::string rule) {
-		this->replaceAll(rule, "FX", "F[-FX]F[-<FX]F[-<<FX]");
-		return rule;
-		}, std::string("FX"), DirectX::XM_PI / 6, 2 * DirectX::XM_PI / 3, 0.15f, 0.7f, .5f, 0.8f);
-		tree2Mesh = species2->Build(species2->Grow(4).c_str(), device, context);
+	const int numVariants = 4;
+	//the species live in a text file; the compiled pack next to it is rebuilt whenever it changes
+	LSpeciesLibrary library;
+	library.Load(GetFullPathTo("../../Assets/Species/Trees.lsys"), GetFullPathTo("../../Assets/Species/Trees.lspc"));
+	//one tree near the start is drawn as instances: a segment per instance of one shared cylinder, and a card per leaf
+	LSpecies* instancedSpecies = library.Find("tree1Leafy");
+	if (instancedSpecies != nullptr) {
+		segmentMesh = LSpecies::BuildSegmentMesh(8, device, context);
+		leafMesh = LSpecies::BuildLeafMesh(device, context);
+		LSpecies::Foliage foliage = { leafMesh, nullptr };
+		instancedTreeSegments = instancedSpecies->BuildInstanced(4, 0, segmentMesh, device, &foliage);
+		instancedTreeLeaves = foliage.leaves;
+	}
+	if (instancedTreeSegments != nullptr) {
+		instancedTree = std::make_shared<MeshEntity>(instancedTreeSegments, instancedBark);
+		instancedTree->GetTransform()->SetPosition(4, 0, 8);
+		meshEntities.push_back(instancedTree);
+	}
+	if (instancedTreeLeaves != nullptr) {
+		instancedTreeFoliage = std::make_shared<MeshEntity>(instancedTreeLeaves, leaves);
+		instancedTreeFoliage->GetTransform()->SetPosition(4, 0, 8);
+		meshEntities.push_back(instancedTreeFoliage);
+	}
+	//the varied species draw a different tree per seed; tree1 and tree2 themselves always grow the same one
+	LSpecies* species1 = library.Find("tree1Varied");
+	LSpecies* species2 = library.Find("tree2Varied");
+	if (species1 == nullptr || species2 == nullptr) {
+		printf("TestLSystem: Trees.lsys needs species tree1Varied and tree2Varied\n");
+		return;
+	}
+#ifdef LSYSTEM_BENCHMARK
+	BenchmarkLSystem(species1, "tree1Varied");
+	BenchmarkLSystem(species2, "tree2Varied");
+#endif
+	//every level comes out of one walk of the turtle; the far ones get fewer sides and lose their twigs
+	const std::vector<LSpecies::Detail> details = { { 12, 0 }, { 8, 0 }, { 4, 0.07f }, { 3, 0.14f } };
+	for (int seed = 0; seed < numVariants; ++seed) {
+		tree1Meshes.push_back(species1->Build(4, seed, details, device, context));
+		tree2Meshes.push_back(species2->Build(4, seed, details, device, context));
+	}
 
 	srand((unsigned)time(NULL));
 	for (int i = 0; i < 10; ++i) {
@@ -116,17 +169,63 @@ void Game::TestLSystem() {
 			float random = rand() / (float)RAND_MAX;
 
 			bool tree1 = random < (1.0f/((i-1)*(i-1)+(j-1)*(j-1)))/(1.0f / ((i - 1) * (i - 1) + (j - 1) * (j - 1)) + 1.0f/((i-9) * (i-9) + (j-9) * (j-9)));
-			trees.push_back(std::make_shared<MeshEntity>(tree1 ? tree1Mesh : tree2Mesh, tree1?bark:birch));
+			int variant = rand() % numVariants;
+			treeDetails.push_back(tree1 ? &tree1Meshes[variant] : &tree2Meshes[variant]);
+			trees.push_back(std::make_shared<MeshEntity>(treeDetails.back()->front(), tree1?bark:birch));
 			trees.back()->GetTransform()->SetPosition((i-5.5 + (rand() / (float)RAND_MAX))*10, 0, (j-5.5+(rand() / (float)RAND_MAX))*10);
 			trees.back()->GetTransform()->SetRotation(0, rand() / (float)RAND_MAX * XM_2PI, 0);
 			float scalar = 2 * pow(1.5f, (rand() / (float)RAND_MAX) * 2 - 1);
 			trees.back()->GetTransform()->SetScale(scalar, scalar, scalar);
 		}
 	}
+}
 
-	delete species1;
-	delete species2;
+#ifdef LSYSTEM_BENCHMARK
+// Times Grow, and a scan for the modules that draw, at each scan width the CPU supports.  Grow is
+// the one into buffers of the benchmark's own, so no timing is helped or hindered by the grow cache.
+void Game::BenchmarkLSystem(LSpecies* species, const char* name) {
+	const int iterations = 6;
+	const int repeats = 10;
+	LGlyphSet geometry;
+	geometry.Add('F');
+	geometry.Add('X');
+	geometry.Add('L');
+	const LScanLevel best = LGetScanLevel();
+	const LScanLevel levels[] = { LScanLevel::Scalar, LScanLevel::SSE2, LScanLevel::AVX2 };
+	const unsigned int growThreads = species->GetGrowThreads();
+	const size_t minModulesPerThread = species->GetMinModulesPerThread();
+	species->SetGrowThreads(1);
+	LString grownString;
+	LString scratch;
+	for (LScanLevel level : levels) {
+		if (!LSetScanLevel(level)) {
+			continue;
+		}
+		size_t geometryModules = 0;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int r = 0; r < repeats; ++r) {
+			species->Grow(iterations, r, grownString, scratch);
+		}
+		auto grown = std::chrono::high_resolution_clock::now();
+		species->Grow(iterations, 0, grownString, scratch);
+		const std::string& symbols = grownString.symbols;
+		auto scanStart = std::chrono::high_resolution_clock::now();
+		for (int r = 0; r < repeats; ++r) {
+			geometryModules = 0;
+			for (size_t cursor = LFindFirstOf(symbols.data(), symbols.size(), geometry); cursor < symbols.size(); ) {
+				++geometryModules;
+				cursor += 1 + LFindFirstOf(symbols.data() + cursor + 1, symbols.size() - cursor - 1, geometry);
+			}
+		}
+		auto scanned = std::chrono::high_resolution_clock::now();
+		printf("%s %-6s: grow %.3f ms, scan %.3f ms (%zu of %zu modules draw)\n", name, LScanLevelName(level),
+			std::chrono::duration<double, std::milli>(grown - start).count() / repeats,
+			std::chrono::duration<double, std::milli>(scanned - scanStart).count() / repeats, geometryModules, symbols.size());
+	}
+	LSetScanLevel(best);
+	species->SetGrowThreads(growThreads, minModulesPerThread);
 }
+#endif
 
 
 // --------------------------------------------------------
@@ -141,6 +240,8 @@ void Game::LoadShaders()
 {
 	vertexShader = std::make_shared<SimpleVertexShader>(device, context, GetFullPathTo_Wide(L"VertexShader.cso").c_str());    
 	skyBoxVertexShader = std::make_shared<SimpleVertexShader>(device, context, GetFullPathTo_Wide(L"SkyBoxVertexShader.cso").c_str());
+	instancedSegmentShader = std::make_shared<SimpleVertexShader>(device, context, GetFullPathTo_Wide(L"InstancedSegmentVertexShader.cso").c_str());
+	instancedLeafShader = std::make_shared<SimpleVertexShader>(device, context, GetFullPathTo_Wide(L"InstancedLeafVertexShader.cso").c_str());
 	skyBoxPixelShader = std::make_shared<SimplePixelShader>(device, context, GetFullPathTo_Wide(L"SkyBoxPixelShader.cso").c_str());
 	basicLightingShader = std::make_shared<SimplePixelShader>(device, context, GetFullPathTo_Wide(L"BasicLightingPixelShader.cso").c_str());
 	transparencyShader = std::make_shared<SimplePixelShader>(device, context, GetFullPathTo_Wide(L"TransparencyPixelShader.cso").c_str());
@@ -225,6 +326,8 @@ void Game::CreateBasicGeometry()
 	birch = new Material(XMFLOAT4(1, 1, 1, 1), vertexShader, basicLightingShader);
 	grass = new Material(XMFLOAT4(1, 1, 1, 1), vertexShader, basicLightingShader);
 	aluminum = new Material(XMFLOAT4(1, 1, 1, 1), vertexShader, basicLightingShader);
+	instancedBark = new Material(XMFLOAT4(1, 1, 1, 1), instancedSegmentShader, basicLightingShader);
+	leaves = new Material(XMFLOAT4(0.6f, 0.9f, 0.5f, 1), instancedLeafShader, basicLightingShader);
 
 	bark->AddTextureSRV("Albedo", barkAlbedo);
 	bark->AddTextureSRV("RoughnessMap", barkRoughness);
@@ -250,6 +353,18 @@ void Game::CreateBasicGeometry()
 	aluminum->AddTextureSRV("MetalnessMap", alumMetalness);
 	aluminum->AddSampler("Sampler", samplerState); //can't call ut SamplerState because thats an HLSL keyword
 
+	instancedBark->AddTextureSRV("Albedo", barkAlbedo);
+	instancedBark->AddTextureSRV("RoughnessMap", barkRoughness);
+	instancedBark->AddTextureSRV("NormalMap", barkNormals);
+	instancedBark->AddTextureSRV("MetalnessMap", barkMetalness);
+	instancedBark->AddSampler("Sampler", samplerState);
+
+	leaves->AddTextureSRV("Albedo", grassAlbedo);
+	leaves->AddTextureSRV("RoughnessMap", grassRoughness);
+	leaves->AddTextureSRV("NormalMap", grassNormals);
+	leaves->AddTextureSRV("MetalnessMap", barkMetalness);
+	leaves->AddSampler("Sampler", samplerState);
+
 	cubeMesh = new Mesh(GetFullPathTo("../../Assets/Models/cube.obj").c_str(), device, context);
 	sphereMesh = new Mesh(GetFullPathTo("../../Assets/Models/sphere.obj").c_str(), device, context);
 	planeMesh = new Mesh(GetFullPathTo("../../Assets/Models/quad.obj").c_str(), device, context);
@@ -282,18 +397,6 @@ void Game::OnResize()
 	ResizeOnePostProcessResource(gammaCorrectionRTV, gammaCorrectionSRV);
 }
 
-//stackoverflow.com/questions/3418231/replace-part-of-a-string-with-another-string
-void Game::replaceAll(std::string& str, const std::string& from, const std::string& to) {
-	if (from.empty())
-		return;
-	size_t start_pos = 0;
-	std::string result;
-	while ((start_pos = str.find(from, start_pos)) != std::string::npos) {
-		str.replace(start_pos, from.length(), to);
-		start_pos += to.length();
-	}
-}
-
 // Adapted from code by Chris Casciolli 
 // https ://github.com/vixorien/ggp-demos/blob/main/16%20-%20Bloom%20Post%20Process/Game.cpp
 void Game::ResizeOnePostProcessResource(
@@ -423,8 +526,38 @@ void Game::Draw(float deltaTime, float totalTime)
 		}
 		currentEntity->Draw(camera, context);
 	}
+	//distances from the camera past which trees switch to each coarser level of detail
+	const float detailDistances[] = { 15, 30, 60 };
+	XMFLOAT3 cameraPosition = camera->GetTransform()->GetPosition();
 	for (int i = 0; i < trees.size(); ++i) {
 		std::shared_ptr<MeshEntity> currentEntity = trees.at(i);
+		XMFLOAT3 position = currentEntity->GetTransform()->GetPosition();
+		float dist;
+		XMStoreFloat(&dist, XMVector3Length(XMVectorSubtract(XMLoadFloat3(&position), XMLoadFloat3(&cameraPosition))));
+		//the thresholds are for a tree at its built size, so a tree scaled up keeps its detail further out
+		XMFLOAT3 scale = currentEntity->GetTransform()->GetScale();
+		XMStoreFloat3(&scale, XMVectorAbs(XMLoadFloat3(&scale)));
+		const float maxScale = scale.x > scale.y ? (scale.x > scale.z ? scale.x : scale.z) : (scale.y > scale.z ? scale.y : scale.z);
+		if (maxScale > 0) {
+			dist /= maxScale;
+		}
+		const std::vector<Mesh*>& details = *treeDetails[i];
+		if (details.empty()) {
+			continue;
+		}
+		size_t level = 0;
+		while (level + 1 < details.size() && level < sizeof(detailDistances) / sizeof(detailDistances[0]) && dist > detailDistances[level]) {
+			++level;
+		}
+		//a level too coarse to keep anything of this tree falls back to the next finer one
+		while (level > 0 && details[level] == nullptr) {
+			--level;
+		}
+		//nothing at any level, e.g. an empty tree, so there's nothing to draw
+		if (details[level] == nullptr) {
+			continue;
+		}
+		currentEntity->SetMesh(details[level]);
 		//should work fine without checking (just potentially unneccessary setting), does this help or hurt performance?
 		if (currentEntity->GetMaterial()->GetPixelShader() == basicLightingShader) {
 			currentEntity->GetMaterial()->BindResources();
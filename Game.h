@@ -13,6 +13,8 @@
 #include "Camera.h"
 #include "Skybox.h"
 
+class LSpecies;
+
 class Game 
 	: public DXCore
 {
@@ -40,6 +42,8 @@ private:
 	std::shared_ptr<SimplePixelShader> skyBoxPixelShader;
 	std::shared_ptr<SimpleVertexShader> vertexShader;
 	std::shared_ptr<SimpleVertexShader> skyBoxVertexShader;
+	std::shared_ptr<SimpleVertexShader> instancedSegmentShader;
+	std::shared_ptr<SimpleVertexShader> instancedLeafShader;
 
 	std::shared_ptr<Camera> camera;
 	Transform* camTransform;
@@ -47,13 +51,22 @@ private:
 	Mesh* planeMesh;
 	Mesh* sphereMesh;
 	Mesh* cubeMesh;
-	Mesh* tree1Mesh;
-	Mesh* tree2Mesh;
+	//per stochastic variant of each species, a mesh per level of detail, finest first
+	std::vector<std::vector<Mesh*>> tree1Meshes;
+	std::vector<std::vector<Mesh*>> tree2Meshes;
+	//the instanced tree's segments are all drawn with this one cylinder, and its leaves with this one card
+	Mesh* segmentMesh;
+	Mesh* leafMesh;
+	InstancedMesh* instancedTreeSegments;
+	InstancedMesh* instancedTreeLeaves;
 
 	SkyBox* skyBox;
 
 	std::vector<std::shared_ptr<MeshEntity>> trees;
+	std::vector<const std::vector<Mesh*>*> treeDetails; //the levels each tree picks its mesh from by distance
 	std::shared_ptr<MeshEntity> tree2instance1;
+	std::shared_ptr<MeshEntity> instancedTree;
+	std::shared_ptr<MeshEntity> instancedTreeFoliage;
 	std::shared_ptr<MeshEntity> player;
 	std::shared_ptr<MeshEntity> ground;
 
@@ -90,6 +103,8 @@ private:
 	Material* birch;
 	Material* aluminum;
 	Material* grass;
+	Material* instancedBark;
+	Material* leaves;
 
 	ID3D11BlendState* transparencyBlendState;
 
@@ -99,11 +114,13 @@ private:
 
 	// Initialization helper methods - feel free to customize, combine, etc.
 	void TestLSystem();
+#ifdef LSYSTEM_BENCHMARK
+	void BenchmarkLSystem(LSpecies* species, const char* name);
+#endif
 	void LoadShaders(); 
 	void CreateBasicGeometry();
 	void SetLights();
 	void ResizeOnePostProcessResource(Microsoft::WRL::ComPtr<ID3D11RenderTargetView>& rtv, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>& srv);
-	void replaceAll(std::string& str, const std::string& from, const std::string& to);
 
 	// Note the usage of ComPtr below
 	//  - This is a smart pointer for objects that abide by the
@@ -0,0 +1,32 @@
+#include "StructIncludes.hlsli"
+#include "QuaternionIncludes.hlsli"
+
+cbuffer externalData : register(b0) {
+	matrix world;
+	matrix worldInvTranspose;
+	matrix view;
+	matrix projection;
+}
+
+// --------------------------------------------------------
+// Draws the shared leaf card once per leaf: scaled, turned
+// by the leaf's orientation and moved to where it hangs in
+// the tree, before the tree's own world matrix applies
+// --------------------------------------------------------
+VertexToPixel main( LeafVertexShaderInput input )
+{
+	// Set up output struct
+	VertexToPixel output;
+
+	float4 treePosition = float4(Rotate(input.localPosition * input.scale, input.orientation) + input.leafPosition, 1.0f);
+
+	matrix wvp = mul(projection, mul(view, world));
+	output.screenPosition = mul(wvp, treePosition);
+
+	output.uv = input.uv;
+	output.normal = mul((float3x3)world, Rotate(input.normal, input.orientation));
+	output.worldPosition = mul(world, treePosition).xyz;
+	output.tangent = mul((float3x3)world, Rotate(input.tangent, input.orientation));
+
+	return output;
+}
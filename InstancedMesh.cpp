@@ -0,0 +1,42 @@
+#include "InstancedMesh.h"
+
+InstancedMesh::InstancedMesh(Mesh* mesh, const void* instances, unsigned int instanceStride, unsigned int numInstances, Microsoft::WRL::ComPtr<ID3D11Device> device)
+{
+	this->mesh = mesh;
+	this->instanceStride = instanceStride;
+	this->numInstances = numInstances;
+
+	// The instances never change once built, just like a Mesh's vertices
+	D3D11_BUFFER_DESC ibd = {};
+	ibd.Usage = D3D11_USAGE_IMMUTABLE;
+	ibd.ByteWidth = instanceStride * numInstances;
+	ibd.BindFlags = D3D11_BIND_VERTEX_BUFFER; // Bound as a second vertex buffer
+	ibd.CPUAccessFlags = 0;
+	ibd.MiscFlags = 0;
+	ibd.StructureByteStride = 0;
+
+	D3D11_SUBRESOURCE_DATA initialInstanceData = {};
+	initialInstanceData.pSysMem = instances;
+
+	device->CreateBuffer(&ibd, &initialInstanceData, instanceBuffer.GetAddressOf());
+}
+
+Mesh* InstancedMesh::GetMesh()
+{
+	return mesh;
+}
+
+Microsoft::WRL::ComPtr<ID3D11Buffer> InstancedMesh::GetInstanceBuffer()
+{
+	return instanceBuffer;
+}
+
+unsigned int InstancedMesh::GetInstanceCount()
+{
+	return numInstances;
+}
+
+void InstancedMesh::Draw()
+{
+	mesh->DrawInstanced(instanceBuffer, instanceStride, numInstances);
+}
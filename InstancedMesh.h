@@ -0,0 +1,24 @@
+#pragma once
+#include <d3d11.h>
+#include <wrl/client.h> // Used for ComPtr - a smart pointer for COM objects
+#include "Mesh.h"
+
+// --------------------------------------------------------
+// A shared Mesh drawn once per record of an instance buffer.
+// The vertex shader reads the records from input slot 1,
+// through inputs whose semantics end in _PER_INSTANCE.
+// --------------------------------------------------------
+class InstancedMesh
+{
+private:
+	Mesh* mesh; //shared between instanced meshes, so not owned
+	Microsoft::WRL::ComPtr<ID3D11Buffer> instanceBuffer;
+	unsigned int instanceStride;
+	unsigned int numInstances;
+public:
+	InstancedMesh(Mesh* mesh, const void* instances, unsigned int instanceStride, unsigned int numInstances, Microsoft::WRL::ComPtr<ID3D11Device> device);
+	Mesh* GetMesh();
+	Microsoft::WRL::ComPtr<ID3D11Buffer> GetInstanceBuffer();
+	unsigned int GetInstanceCount();
+	void Draw();
+};
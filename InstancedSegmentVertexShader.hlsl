@@ -0,0 +1,41 @@
+#include "StructIncludes.hlsli"
+#include "QuaternionIncludes.hlsli"
+
+cbuffer externalData : register(b0) {
+	matrix world;
+	matrix worldInvTranspose;
+	matrix view;
+	matrix projection;
+}
+
+// --------------------------------------------------------
+// Draws the shared unit cylinder as one branch segment per
+// instance: scaled to the segment's radii and length, turned
+// by its orientation and moved to its position in the tree,
+// before the tree's own world matrix applies as usual
+// --------------------------------------------------------
+VertexToPixel main( SegmentVertexShaderInput input )
+{
+	// Set up output struct
+	VertexToPixel output;
+
+	// The radius tapers from bottom to top, so tips are cones
+	float radius = lerp(input.bottomRadius, input.topRadius, input.localPosition.z);
+	float3 segmentPosition = float3(input.localPosition.xy * radius, input.localPosition.z * input.length);
+	float4 treePosition = float4(Rotate(segmentPosition, input.orientation) + input.segmentPosition, 1.0f);
+
+	matrix wvp = mul(projection, mul(view, world));
+	output.screenPosition = mul(wvp, treePosition);
+
+	output.uv = input.uv;
+	// The cylinder's normals point straight out; a tapering segment's
+	// lean towards its top by the slope of its radius, as the
+	// tips the turtle draws lean towards their point
+	float slope = (input.bottomRadius - input.topRadius) / max(input.length, 0.0001f);
+	float3 segmentNormal = normalize(float3(input.normal.xy, slope));
+	output.normal = mul((float3x3)world, Rotate(segmentNormal, input.orientation));
+	output.worldPosition = mul(world, treePosition).xyz;
+	output.tangent = mul((float3x3)world, Rotate(input.tangent, input.orientation));
+
+	return output;
+}
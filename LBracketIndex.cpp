@@ -0,0 +1,122 @@
+#include "LBracketIndex.h"
+#include "LSymbol.h"
+#include <cstdio>
+
+const uint32_t LBracketIndex::None;
+
+// Turns and decays don't take part in context matching, so a signal can pass e.g. A+[...]-B
+static bool IsContextModule(char glyph)
+{
+	switch (ToSymbol(glyph))
+	{
+	case LSymbol::PitchDown:
+	case LSymbol::PitchUp:
+	case LSymbol::RollRight:
+	case LSymbol::RollLeft:
+	case LSymbol::ThicknessDecay:
+	case LSymbol::LengthDecay:
+	case LSymbol::Push:
+	case LSymbol::Pop:
+		return false;
+	default:
+		return true;
+	}
+}
+
+bool LBracketIndex::Fits(uint64_t modules, uint64_t parameters)
+{
+	return modules < None && parameters < None;
+}
+
+bool LBracketIndex::Fits(const LString& string)
+{
+	return Fits(string.symbols.size(), string.parameters.size());
+}
+
+void LBracketIndex::BuildBrackets(const LString& string, const uint8_t* arity)
+{
+	if (!Fits(string)) {
+		printf("LBracketIndex: %llu modules and %llu parameters are too many to index\n", (unsigned long long)string.symbols.size(), (unsigned long long)string.parameters.size());
+		*this = LBracketIndex();
+		return;
+	}
+	const uint32_t length = (uint32_t)string.symbols.size();
+	const char* symbols = string.symbols.data();
+	match.assign(length, None);
+	depth.resize(length);
+	parameterOffset.resize(length);
+	std::vector<uint32_t> open;
+	uint32_t offset = 0;
+	for (uint32_t i = 0; i < length; ++i) {
+		parameterOffset[i] = offset;
+		offset += arity[(unsigned char)symbols[i]];
+		if (symbols[i] == ']' && !open.empty()) {
+			match[i] = open.back();
+			match[open.back()] = i;
+			open.pop_back();
+		}
+		depth[i] = (uint32_t)open.size();
+		if (symbols[i] == '[') {
+			open.push_back(i);
+		}
+	}
+}
+
+void LBracketIndex::Build(const LString& string, const uint8_t* arity)
+{
+	BuildBrackets(string, arity);
+	if (!Fits(string)) {
+		return;
+	}
+	const uint32_t length = (uint32_t)string.symbols.size();
+	const char* symbols = string.symbols.data();
+	left.resize(length);
+	right.resize(length);
+
+	//forward pass: left neighbors.  The stack holds the last module before each open branch,
+	//which is what the branch's first module sees.
+	std::vector<uint32_t> stack;
+	uint32_t last = None;
+	for (uint32_t i = 0; i < length; ++i) {
+		left[i] = last;
+		if (symbols[i] == '[') {
+			stack.push_back(last);
+		}
+		else if (symbols[i] == ']') {
+			if (!stack.empty()) {
+				last = stack.back();
+				stack.pop_back();
+			}
+		}
+		else if (IsContextModule(symbols[i])) {
+			last = i;
+		}
+	}
+
+	//backward pass: right neighbors.  Entering a branch from its end there's nothing to its
+	//right; leaving it through its '[' restores what followed the branch.
+	stack.clear();
+	uint32_t next = None;
+	for (uint32_t i = length; i-- > 0;) {
+		right[i] = next;
+		if (symbols[i] == ']') {
+			stack.push_back(next);
+			next = None;
+		}
+		else if (symbols[i] == '[') {
+			if (!stack.empty()) {
+				next = stack.back();
+				stack.pop_back();
+			}
+		}
+		else if (IsContextModule(symbols[i])) {
+			next = i;
+		}
+	}
+}
+
+uint32_t LBracketIndex::SkipBranch(uint32_t position) const
+{
+	const uint32_t partner = match[position];
+	return partner == None || partner < position ? position + 1 : partner + 1;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "LString.h"
+
+// Per-module lookup tables over a grown string, built in linear passes so productions can find
+// their context, and the turtle can skip a whole branch, in O(1).  Neighbors are found along the
+// branch structure: side branches in [brackets] are skipped over, and the start of a branch sees
+// the module it grew from.
+struct LBracketIndex {
+	static const uint32_t None = UINT32_MAX;
+	std::vector<uint32_t> match;           // for '[' and ']', the position of the partner bracket
+	std::vector<uint32_t> depth;           // branches enclosing each module; a bracket counts as outside its branch
+	std::vector<uint32_t> parameterOffset; // where each module's parameters start
+	std::vector<uint32_t> left;            // the nearest module before this one on the path to the root
+	std::vector<uint32_t> right;           // the next module after this one in the same branch
+
+	// Just match, depth and parameterOffset, which is all skipping branches needs
+	void BuildBrackets(const LString& string, const uint8_t* arity);
+	// Everything, for context matching
+	void Build(const LString& string, const uint8_t* arity);
+	// Position just past the branch opened at position, or position + 1 if it isn't a matched '['
+	uint32_t SkipBranch(uint32_t position) const;
+	// Positions and parameter offsets are 32 bits, with None taken, so only strings of fewer than None
+	// modules and None parameters can be indexed.  Building an index of any other leaves it empty.
+	static bool Fits(uint64_t modules, uint64_t parameters);
+	static bool Fits(const LString& string);
+};
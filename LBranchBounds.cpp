@@ -0,0 +1,195 @@
+#include "LBranchBounds.h"
+#include <cfloat>
+
+const uint32_t LBranchBounds::None;
+
+void LBranchBounds::Recording::Open()
+{
+	brackets.push_back((uint32_t)segments.size() * 2 + 1);
+}
+
+void LBranchBounds::Recording::Close()
+{
+	brackets.push_back((uint32_t)segments.size() * 2);
+}
+
+void LBranchBounds::Recording::Append(const Recording& from, size_t segmentBegin, size_t segmentEnd, size_t bracketBegin, size_t bracketEnd)
+{
+	//brackets count the segments before them, which moves by however many are already here
+	const uint32_t shift = (uint32_t)(segments.size() - segmentBegin) * 2;
+	segments.insert(segments.end(), from.segments.begin() + segmentBegin, from.segments.begin() + segmentEnd);
+	for (size_t b = bracketBegin; b < bracketEnd; ++b) {
+		brackets.push_back(from.brackets[b] + shift);
+	}
+}
+
+void LBranchBounds::Assemble(const Recording& recording)
+{
+	const size_t segmentCount = recording.segments.size();
+	nodes.clear();
+	std::vector<uint32_t> owner(segmentCount); //the node each recorded segment is drawn in
+	std::vector<uint32_t> open(1, 0);
+	nodes.push_back({ Empty(), None, 0, 0, 0 });
+	size_t s = 0;
+	for (uint32_t bracket : recording.brackets) {
+		for (; s < bracket / 2; ++s) {
+			owner[s] = open.back();
+		}
+		if (bracket & 1) {
+			nodes.push_back({ Empty(), open.back(), 0, 0, 0 });
+			open.push_back((uint32_t)nodes.size() - 1);
+		}
+		else if (open.size() > 1) {
+			nodes[open.back()].end = (uint32_t)nodes.size();
+			open.pop_back();
+		}
+	}
+	for (; s < segmentCount; ++s) {
+		owner[s] = open.back();
+	}
+	for (uint32_t node : open) {
+		nodes[node].end = (uint32_t)nodes.size();
+	}
+	//group the segments by node, keeping each node's in the order they were drawn
+	for (uint32_t node : owner) {
+		++nodes[node].segmentEnd;
+	}
+	uint32_t begin = 0;
+	for (Node& node : nodes) {
+		node.segmentBegin = begin;
+		begin += node.segmentEnd;
+		node.segmentEnd = node.segmentBegin;
+	}
+	segments.resize(segmentCount);
+	segmentOrder.resize(segmentCount);
+	for (size_t i = 0; i < segmentCount; ++i) {
+		const uint32_t slot = nodes[owner[i]].segmentEnd++;
+		segments[slot] = recording.segments[i];
+		segmentOrder[slot] = (uint32_t)i;
+	}
+	//nested nodes come after the node they're in, so going backwards finishes each before its parent
+	for (size_t n = nodes.size(); n-- > 0; ) {
+		Node& node = nodes[n];
+		for (uint32_t i = node.segmentBegin; i < node.segmentEnd; ++i) {
+			Grow(node.bounds, segments[i]);
+		}
+		if (node.parent != None) {
+			Grow(nodes[node.parent].bounds, node.bounds);
+		}
+	}
+}
+
+bool LBranchBounds::Bounds(Box& bounds) const
+{
+	if (nodes.empty() || nodes[0].bounds.min.x > nodes[0].bounds.max.x) {
+		return false;
+	}
+	bounds = nodes[0].bounds;
+	return true;
+}
+
+void LBranchBounds::Query(const Box& box, std::vector<uint32_t>& hits) const
+{
+	for (uint32_t n = 0; n < nodes.size(); ) {
+		const Node& node = nodes[n];
+		if (!Overlaps(node.bounds, box)) {
+			n = node.end;
+			continue;
+		}
+		for (uint32_t i = node.segmentBegin; i < node.segmentEnd; ++i) {
+			if (Overlaps(segments[i], box)) {
+				hits.push_back(i);
+			}
+		}
+		++n;
+	}
+}
+
+// Where a ray enters box, if it does before far.  Comparisons are arranged so the NaN of a ray
+// starting on a face it runs along constrains nothing.
+static bool EntersBox(const LBranchBounds::Box& box, const float* origin, const float* inverse, float far, float& entry)
+{
+	if (box.min.x > box.max.x) {
+		return false;
+	}
+	const float* min = &box.min.x;
+	const float* max = &box.max.x;
+	float near = 0;
+	for (int i = 0; i < 3; ++i) {
+		float t0 = (min[i] - origin[i]) * inverse[i];
+		float t1 = (max[i] - origin[i]) * inverse[i];
+		if (t0 > t1) {
+			const float swap = t0;
+			t0 = t1;
+			t1 = swap;
+		}
+		near = t0 > near ? t0 : near;
+		far = t1 < far ? t1 : far;
+	}
+	entry = near;
+	return near <= far;
+}
+
+bool LBranchBounds::Raycast(const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float maxDistance, float& distance, uint32_t& segment) const
+{
+	const float start[3] = { origin.x, origin.y, origin.z };
+	const float inverse[3] = { 1 / direction.x, 1 / direction.y, 1 / direction.z };
+	bool hit = false;
+	float nearest = maxDistance;
+	for (uint32_t n = 0; n < nodes.size(); ) {
+		const Node& node = nodes[n];
+		float entry;
+		//a branch can't hold anything nearer than where the ray enters it
+		if (!EntersBox(node.bounds, start, inverse, nearest, entry)) {
+			n = node.end;
+			continue;
+		}
+		for (uint32_t i = node.segmentBegin; i < node.segmentEnd; ++i) {
+			if (EntersBox(segments[i], start, inverse, nearest, entry) && (!hit || entry < nearest)) {
+				hit = true;
+				nearest = entry;
+				segment = i;
+			}
+		}
+		++n;
+	}
+	distance = nearest;
+	return hit;
+}
+
+const std::vector<LBranchBounds::Node>& LBranchBounds::GetNodes() const
+{
+	return nodes;
+}
+
+const std::vector<LBranchBounds::Box>& LBranchBounds::GetSegments() const
+{
+	return segments;
+}
+
+const std::vector<uint32_t>& LBranchBounds::GetSegmentOrder() const
+{
+	return segmentOrder;
+}
+
+LBranchBounds::Box LBranchBounds::Empty()
+{
+	return { DirectX::XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX), DirectX::XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX) };
+}
+
+void LBranchBounds::Grow(Box& box, const Box& by)
+{
+	box.min.x = by.min.x < box.min.x ? by.min.x : box.min.x;
+	box.min.y = by.min.y < box.min.y ? by.min.y : box.min.y;
+	box.min.z = by.min.z < box.min.z ? by.min.z : box.min.z;
+	box.max.x = by.max.x > box.max.x ? by.max.x : box.max.x;
+	box.max.y = by.max.y > box.max.y ? by.max.y : box.max.y;
+	box.max.z = by.max.z > box.max.z ? by.max.z : box.max.z;
+}
+
+bool LBranchBounds::Overlaps(const Box& a, const Box& b)
+{
+	return a.min.x <= b.max.x && a.max.x >= b.min.x &&
+		a.min.y <= b.max.y && a.max.y >= b.min.y &&
+		a.min.z <= b.max.z && a.max.z >= b.min.z;
+}
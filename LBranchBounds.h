@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <DirectXMath.h>
+
+// Axis-aligned boxes around the segments of a built tree, so culling, collision and raycasts can find
+// the branches they care about without reading vertices back.  There's a node per branch, i.e. per
+// [bracket pair], bounding its own segments and everything nested in it, with the trunk at the root.
+// Nodes are kept in the order their branches open, each knowing where its descendants end, so a
+// query walks them front to back and jumps past a whole branch whose box it misses.
+class LBranchBounds
+{
+public:
+	static const uint32_t None = UINT32_MAX;
+	struct Box {
+		DirectX::XMFLOAT3 min;
+		DirectX::XMFLOAT3 max;
+	};
+	struct Node {
+		Box bounds;            // the branch and every branch nested in it; empty if none of it was drawn
+		uint32_t parent;       // None for the trunk
+		uint32_t end;          // one past the last node nested in this one
+		uint32_t segmentBegin; // the branch's own segments, not those of branches nested in it
+		uint32_t segmentEnd;
+	};
+	// What the turtle records as it draws, in string order: a box per segment and tip, and where
+	// each branch opens and closes among them
+	struct Recording {
+		std::vector<Box> segments;
+		std::vector<uint32_t> brackets; // segments before the bracket times two, plus one for '['
+		void Open();
+		void Close();
+		// Appends from's segments [segmentBegin, segmentEnd), and its brackets [bracketBegin, bracketEnd),
+		// which must fall among those segments
+		void Append(const Recording& from, size_t segmentBegin, size_t segmentEnd, size_t bracketBegin, size_t bracketEnd);
+	};
+
+	// Replaces the nodes with those of what the turtle recorded.  A ']' with no '[' is ignored, and
+	// branches still open at the end are closed there.
+	void Assemble(const Recording& recording);
+	// Of the whole tree; false if nothing was drawn
+	bool Bounds(Box& bounds) const;
+	// Appends the index into GetSegments of each segment whose box overlaps box
+	void Query(const Box& box, std::vector<uint32_t>& hits) const;
+	// The nearest segment box hit by a ray from origin along direction, no further than maxDistance
+	// lengths of direction.  Sets distance, in the same units, and segment, the index into GetSegments.
+	bool Raycast(const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction, float maxDistance, float& distance, uint32_t& segment) const;
+	const std::vector<Node>& GetNodes() const;
+	const std::vector<Box>& GetSegments() const; //grouped by the branch they're in
+	// For each of GetSegments, which segment or tip it is in the order the turtle drew them, which is
+	// also the order of BuildInstanced's instances
+	const std::vector<uint32_t>& GetSegmentOrder() const;
+
+	static Box Empty(); //contains nothing, and grows to whatever it's grown by
+	static void Grow(Box& box, const Box& by);
+	static bool Overlaps(const Box& a, const Box& b);
+
+private:
+	std::vector<Node> nodes;
+	std::vector<Box> segments;
+	std::vector<uint32_t> segmentOrder;
+};
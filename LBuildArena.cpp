@@ -0,0 +1,15 @@
+#include "LBuildArena.h"
+
+LBuildArena::Buffers& LBuildArena::At(size_t index)
+{
+	if (buffers.size() <= index) {
+		buffers.resize(index + 1);
+	}
+	return buffers[index];
+}
+
+void LBuildArena::Clear()
+{
+	std::vector<Buffers>().swap(buffers);
+	brackets = LBracketIndex();
+}
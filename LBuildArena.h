@@ -0,0 +1,29 @@
+#pragma once
+#include <vector>
+#include "Vertex.h"
+#include "LState.h"
+#include "LBracketIndex.h"
+#include "SegmentInstance.h"
+#include "LeafInstance.h"
+#include "LBranchBounds.h"
+
+// Buffers LSpecies::Build draws into, kept between builds so building many trees reuses their
+// capacity instead of allocating it all again.  A build uses the one it's given, or its species'
+// own if none; threads building trees at the same time each pass one of their own.
+struct LBuildArena {
+	// What one turtle draws into
+	struct Buffers {
+		std::vector<std::vector<Vertex>> vertices; // per level of detail
+		std::vector<std::vector<unsigned int>> indices;
+		std::vector<LState> savedStates;
+		std::vector<LFooting> savedFootings;
+		std::vector<SegmentInstance> instances;
+		std::vector<LeafInstance> leaves;
+		LBranchBounds::Recording bounds;
+	};
+	std::vector<Buffers> buffers; // [0] for the turtle a build draws with, the rest for a parallel trace's spine and branches
+	LBracketIndex brackets;       // the parallel trace's
+
+	Buffers& At(size_t index); //grows buffers to have index
+	void Clear();              //frees everything
+};
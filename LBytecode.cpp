@@ -0,0 +1,315 @@
+#include "LBytecode.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+
+bool RunLBytecode(const LInstruction* code, unsigned int count, const float* actuals, unsigned int numActuals, float*& out)
+{
+	float registers[LMaxRegisters];
+	if (numActuals > 0) {
+		memcpy(registers, actuals, numActuals * sizeof(float));
+	}
+	for (unsigned int i = 0; i < count; ++i) {
+		const LInstruction& in = code[i];
+		const float a = registers[in.a];
+		const float b = registers[in.b];
+		switch (in.op)
+		{
+		case LOpcode::Constant:
+			registers[in.dst] = in.value;
+			break;
+		case LOpcode::Add:
+			registers[in.dst] = a + b;
+			break;
+		case LOpcode::Subtract:
+			registers[in.dst] = a - b;
+			break;
+		case LOpcode::Multiply:
+			registers[in.dst] = a * b;
+			break;
+		case LOpcode::Divide:
+			registers[in.dst] = a / b;
+			break;
+		case LOpcode::Power:
+			registers[in.dst] = powf(a, b);
+			break;
+		case LOpcode::Negate:
+			registers[in.dst] = -a;
+			break;
+		case LOpcode::Less:
+			registers[in.dst] = a < b ? 1.f : 0.f;
+			break;
+		case LOpcode::LessEqual:
+			registers[in.dst] = a <= b ? 1.f : 0.f;
+			break;
+		case LOpcode::Greater:
+			registers[in.dst] = a > b ? 1.f : 0.f;
+			break;
+		case LOpcode::GreaterEqual:
+			registers[in.dst] = a >= b ? 1.f : 0.f;
+			break;
+		case LOpcode::Equal:
+			registers[in.dst] = a == b ? 1.f : 0.f;
+			break;
+		case LOpcode::NotEqual:
+			registers[in.dst] = a != b ? 1.f : 0.f;
+			break;
+		case LOpcode::And:
+			registers[in.dst] = (a != 0 && b != 0) ? 1.f : 0.f;
+			break;
+		case LOpcode::Or:
+			registers[in.dst] = (a != 0 || b != 0) ? 1.f : 0.f;
+			break;
+		case LOpcode::Not:
+			registers[in.dst] = a == 0 ? 1.f : 0.f;
+			break;
+		case LOpcode::Test:
+			if (a == 0) {
+				return false;
+			}
+			break;
+		case LOpcode::Emit:
+			*out++ = a;
+			break;
+		}
+	}
+	return true;
+}
+
+LExpressionCompiler::LExpressionCompiler(const std::vector<std::string>& formals, std::vector<LInstruction>& code) :
+	formals(formals), code(code), nextRegister(0), cursor(nullptr), end(nullptr)
+{
+}
+
+bool LExpressionCompiler::Compile(const char*& text, const char* textEnd, uint8_t& result)
+{
+	cursor = text;
+	end = textEnd;
+	nextRegister = (unsigned int)formals.size();
+	error.clear();
+	if (!ParseOr(result)) {
+		return false;
+	}
+	SkipSpaces();
+	text = cursor;
+	return true;
+}
+
+const std::string& LExpressionCompiler::GetError()
+{
+	return error;
+}
+
+void LExpressionCompiler::SkipSpaces()
+{
+	while (cursor != end && isspace((unsigned char)*cursor)) {
+		++cursor;
+	}
+}
+
+//consumes token if it's next, but never the first half of a longer operator
+bool LExpressionCompiler::Accept(const char* token)
+{
+	SkipSpaces();
+	const size_t length = strlen(token);
+	if ((size_t)(end - cursor) < length || strncmp(cursor, token, length) != 0) {
+		return false;
+	}
+	if (length == 1 && cursor + 1 != end && cursor[1] == '=' && strchr("<>=!", token[0])) {
+		return false;
+	}
+	if (length == 1 && cursor + 1 != end && cursor[1] == token[0] && strchr("&|", token[0])) {
+		return false;
+	}
+	cursor += length;
+	return true;
+}
+
+bool LExpressionCompiler::Allocate(uint8_t& reg)
+{
+	if (nextRegister >= LMaxRegisters) {
+		error = "expression needs too many registers";
+		return false;
+	}
+	reg = (uint8_t)nextRegister++;
+	return true;
+}
+
+bool LExpressionCompiler::Emit(LOpcode op, uint8_t a, uint8_t b, uint8_t& dst)
+{
+	if (!Allocate(dst)) {
+		return false;
+	}
+	code.push_back({ op, dst, a, b, 0.f });
+	return true;
+}
+
+bool LExpressionCompiler::ParseOr(uint8_t& result)
+{
+	if (!ParseAnd(result)) {
+		return false;
+	}
+	while (Accept("||")) {
+		uint8_t rhs;
+		if (!ParseAnd(rhs) || !Emit(LOpcode::Or, result, rhs, result)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool LExpressionCompiler::ParseAnd(uint8_t& result)
+{
+	if (!ParseComparison(result)) {
+		return false;
+	}
+	while (Accept("&&")) {
+		uint8_t rhs;
+		if (!ParseComparison(rhs) || !Emit(LOpcode::And, result, rhs, result)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool LExpressionCompiler::ParseComparison(uint8_t& result)
+{
+	if (!ParseSum(result)) {
+		return false;
+	}
+	static const struct { const char* token; LOpcode op; } comparisons[] = {
+		{ "<=", LOpcode::LessEqual }, { ">=", LOpcode::GreaterEqual }, { "==", LOpcode::Equal },
+		{ "!=", LOpcode::NotEqual }, { "<", LOpcode::Less }, { ">", LOpcode::Greater }
+	};
+	for (const auto& comparison : comparisons) {
+		if (Accept(comparison.token)) {
+			uint8_t rhs;
+			return ParseSum(rhs) && Emit(comparison.op, result, rhs, result);
+		}
+	}
+	return true;
+}
+
+bool LExpressionCompiler::ParseSum(uint8_t& result)
+{
+	if (!ParseProduct(result)) {
+		return false;
+	}
+	while (true) {
+		LOpcode op;
+		if (Accept("+")) {
+			op = LOpcode::Add;
+		}
+		else if (Accept("-")) {
+			op = LOpcode::Subtract;
+		}
+		else {
+			return true;
+		}
+		uint8_t rhs;
+		if (!ParseProduct(rhs) || !Emit(op, result, rhs, result)) {
+			return false;
+		}
+	}
+}
+
+bool LExpressionCompiler::ParseProduct(uint8_t& result)
+{
+	if (!ParseUnary(result)) {
+		return false;
+	}
+	while (true) {
+		LOpcode op;
+		if (Accept("*")) {
+			op = LOpcode::Multiply;
+		}
+		else if (Accept("/")) {
+			op = LOpcode::Divide;
+		}
+		else {
+			return true;
+		}
+		uint8_t rhs;
+		if (!ParseUnary(rhs) || !Emit(op, result, rhs, result)) {
+			return false;
+		}
+	}
+}
+
+bool LExpressionCompiler::ParseUnary(uint8_t& result)
+{
+	if (Accept("-")) {
+		uint8_t operand;
+		return ParseUnary(operand) && Emit(LOpcode::Negate, operand, operand, result);
+	}
+	if (Accept("!")) {
+		uint8_t operand;
+		return ParseUnary(operand) && Emit(LOpcode::Not, operand, operand, result);
+	}
+	return ParsePower(result);
+}
+
+bool LExpressionCompiler::ParsePower(uint8_t& result)
+{
+	if (!ParsePrimary(result)) {
+		return false;
+	}
+	if (Accept("^")) {
+		uint8_t exponent;
+		return ParseUnary(exponent) && Emit(LOpcode::Power, result, exponent, result);
+	}
+	return true;
+}
+
+bool LExpressionCompiler::ParsePrimary(uint8_t& result)
+{
+	SkipSpaces();
+	if (cursor == end) {
+		error = "unexpected end of expression";
+		return false;
+	}
+	if (Accept("(")) {
+		if (!ParseOr(result)) {
+			return false;
+		}
+		if (!Accept(")")) {
+			error = "missing ')'";
+			return false;
+		}
+		return true;
+	}
+	if (isdigit((unsigned char)*cursor) || *cursor == '.') {
+		//strtof would read past end on an unterminated slice, so copy the literal out first
+		char literal[32] = {};
+		size_t length = 0;
+		while (cursor + length != end && length < sizeof(literal) - 1 && (isdigit((unsigned char)cursor[length]) || cursor[length] == '.')) {
+			literal[length] = cursor[length];
+			++length;
+		}
+		cursor += length;
+		if (!Allocate(result)) {
+			return false;
+		}
+		code.push_back({ LOpcode::Constant, result, 0, 0, strtof(literal, nullptr) });
+		return true;
+	}
+	if (isalpha((unsigned char)*cursor) || *cursor == '_') {
+		const char* start = cursor;
+		while (cursor != end && (isalnum((unsigned char)*cursor) || *cursor == '_')) {
+			++cursor;
+		}
+		const std::string name(start, cursor);
+		for (size_t i = 0; i < formals.size(); ++i) {
+			if (formals[i] == name) {
+				//formal parameters already live in the first registers
+				result = (uint8_t)i;
+				return true;
+			}
+		}
+		error = "unknown parameter '" + name + "'";
+		return false;
+	}
+	error = std::string("unexpected '") + *cursor + "'";
+	return false;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class LOpcode : uint8_t {
+	Constant,     // dst = value
+	Add,          // dst = a + b
+	Subtract,     // dst = a - b
+	Multiply,     // dst = a * b
+	Divide,       // dst = a / b
+	Power,        // dst = a ^ b
+	Negate,       // dst = -a
+	Less,         // dst = a < b
+	LessEqual,    // dst = a <= b
+	Greater,      // dst = a > b
+	GreaterEqual, // dst = a >= b
+	Equal,        // dst = a == b
+	NotEqual,     // dst = a != b
+	And,          // dst = a && b
+	Or,           // dst = a || b
+	Not,          // dst = !a
+	Test,         // stop and fail if a is zero
+	Emit          // append a to the output parameters
+};
+
+// One register-machine instruction.  Registers are floats; the first ones hold the
+// actual parameters of the module being rewritten, the rest are temporaries.
+struct LInstruction {
+	LOpcode op;
+	uint8_t dst;
+	uint8_t a;
+	uint8_t b;
+	float value;
+};
+
+const unsigned int LMaxRegisters = 256;
+
+// Runs count instructions with actuals loaded into the first numActuals registers, appending
+// any emitted values at out and advancing it.  Returns false if a Test instruction failed.
+bool RunLBytecode(const LInstruction* code, unsigned int count, const float* actuals, unsigned int numActuals, float*& out);
+
+// Compiles arithmetic/logical expressions over a module's formal parameters into LInstructions
+class LExpressionCompiler
+{
+private:
+	const std::vector<std::string>& formals;
+	std::vector<LInstruction>& code;
+	unsigned int nextRegister;
+	const char* cursor;
+	const char* end;
+	std::string error;
+
+	void SkipSpaces();
+	bool Accept(const char* token);
+	bool Allocate(uint8_t& reg);
+	bool Emit(LOpcode op, uint8_t a, uint8_t b, uint8_t& dst);
+	bool ParseOr(uint8_t& result);
+	bool ParseAnd(uint8_t& result);
+	bool ParseComparison(uint8_t& result);
+	bool ParseSum(uint8_t& result);
+	bool ParseProduct(uint8_t& result);
+	bool ParseUnary(uint8_t& result);
+	bool ParsePower(uint8_t& result);
+	bool ParsePrimary(uint8_t& result);
+
+public:
+	LExpressionCompiler(const std::vector<std::string>& formals, std::vector<LInstruction>& code);
+	// Compiles the expression starting at text, leaving text just past it.  Temporaries from
+	// previous expressions are reused, so the result must be consumed before the next call.
+	bool Compile(const char*& text, const char* textEnd, uint8_t& result);
+	const std::string& GetError();
+};
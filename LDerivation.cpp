@@ -0,0 +1,234 @@
+#include "LDerivation.h"
+#include "LSpecies.h"
+#include <unordered_map>
+#include <cstring>
+#include <cstdio>
+
+const uint32_t LDerivation::Leaf;
+
+// Bookkeeping only needed while deriving
+struct LDerivation::Builder {
+	struct Shared {
+		uint32_t node;
+		size_t levelStart;
+	};
+	const LSpecies& species;
+	uint32_t seed;
+	std::vector<uint64_t> positions;  // modules visited so far at each depth, for stochastic seeding
+	std::vector<bool> deterministic;  // [remaining * 256 + glyph]: whether the module's subtree makes no random choice
+	std::unordered_map<std::string, Shared> shared; // keyed by glyph, remaining iterations and parameters
+	std::vector<uint64_t> levels;     // modules each shared subtree adds at each later depth, to skip its positions
+
+	Builder(const LSpecies& species, uint32_t seed) : species(species), seed(seed) {};
+};
+
+LDerivation::LDerivation() : rewritten(), arity(), iterations(0)
+{
+}
+
+bool LDerivation::Derive(const LSpecies& species, int iterations, uint32_t seed)
+{
+	symbols.clear();
+	nodes.clear();
+	children.clear();
+	parameters.clear();
+	if (species.contextSensitive) {
+		printf("LDerivation: context-sensitive species can't be derived module by module\n");
+		return false;
+	}
+	//its tables grow with the iteration count, so it stops where Grow would
+	iterations = iterations > LSpecies::MaxIterations ? LSpecies::MaxIterations : iterations;
+	this->iterations = iterations < 0 ? 0 : (unsigned int)iterations;
+	symbols = species.successors;
+	memcpy(arity, species.arity, sizeof(arity));
+	for (int c = 0; c < 256; ++c) {
+		rewritten[c] = species.alternativeStart[c] != (unsigned int)c;
+	}
+	Builder builder(species, seed);
+	builder.positions.assign(this->iterations, 0);
+	//a subtree is deterministic if its module has at most one alternative and so do all its descendants
+	builder.deterministic.assign((this->iterations + 1) * 256, true);
+	for (unsigned int remaining = 1; remaining <= this->iterations; ++remaining) {
+		for (int c = 0; c < 256; ++c) {
+			if (!rewritten[c]) {
+				continue;
+			}
+			bool deterministic = species.alternativeCount[c] == 1;
+			const LSpecies::Alternative& alternative = species.alternatives[species.alternativeStart[c]];
+			for (unsigned int k = 0; k < alternative.length && deterministic; ++k) {
+				deterministic = builder.deterministic[(remaining - 1) * 256 + (unsigned char)species.successors[alternative.start + k]];
+			}
+			builder.deterministic[remaining * 256 + c] = deterministic;
+		}
+	}
+	nodes.push_back({ (uint32_t)symbols.size(), (uint32_t)species.axiom.symbols.size(), 0, 0, 0, 0 });
+	symbols += species.axiom.symbols;
+	parameters = species.axiom.parameters;
+	DeriveModules(builder, 0, 0);
+	return true;
+}
+
+// Rewrites a module of the string at iteration for the remaining iterations, returning its node
+uint32_t LDerivation::DeriveModule(Builder& builder, char glyph, const float* own, unsigned int iteration)
+{
+	const unsigned char c = (unsigned char)glyph;
+	const unsigned int remaining = iterations - iteration;
+	const bool deterministic = builder.deterministic[remaining * 256 + c];
+	std::string key;
+	if (deterministic) {
+		key.push_back(glyph);
+		key.append((const char*)&remaining, sizeof(remaining));
+		key.append((const char*)own, arity[c] * sizeof(float));
+		auto found = builder.shared.find(key);
+		if (found != builder.shared.end()) {
+			++builder.positions[iteration];
+			for (unsigned int d = iteration + 1; d < iterations; ++d) {
+				builder.positions[d] += builder.levels[found->second.levelStart + d - iteration - 1];
+			}
+			return found->second.node;
+		}
+	}
+	const LSpecies::Alternative& alternative = builder.species.SelectAlternative(glyph, own, nullptr, nullptr, builder.positions[iteration]++, builder.seed, iteration);
+	if (builder.species.IsIdentity(alternative)) {
+		//nothing it depends on changes, so it's kept as is from here on
+		for (unsigned int d = iteration + 1; d < iterations; ++d) {
+			++builder.positions[d];
+		}
+		return Leaf;
+	}
+	const uint32_t node = (uint32_t)nodes.size();
+	const size_t parameterStart = parameters.size();
+	nodes.push_back({ alternative.start, alternative.length, 0, (uint32_t)parameterStart, 0, 0 });
+	parameters.resize(parameterStart + alternative.parameterCount);
+	float* out = parameters.data() + parameterStart;
+	RunLBytecode(builder.species.bytecode.data() + alternative.argumentStart, alternative.argumentLength, own, arity[c], out);
+	if (!deterministic) {
+		DeriveModules(builder, node, iteration + 1);
+		return node;
+	}
+	std::vector<uint64_t> before(builder.positions.begin() + iteration + 1, builder.positions.end());
+	DeriveModules(builder, node, iteration + 1);
+	const size_t levelStart = builder.levels.size();
+	for (unsigned int d = iteration + 1; d < iterations; ++d) {
+		builder.levels.push_back(builder.positions[d] - before[d - iteration - 1]);
+	}
+	builder.shared.emplace(key, Builder::Shared{ node, levelStart });
+	return node;
+}
+
+// Derives the children of node, whose modules are part of the string at iteration
+void LDerivation::DeriveModules(Builder& builder, uint32_t node, unsigned int iteration)
+{
+	//copied, since deriving children grows nodes
+	const Node modules = nodes[node];
+	uint64_t expandedLength = 0;
+	uint64_t expandedParameters = 0;
+	uint32_t child = (uint32_t)children.size();
+	if (iteration < iterations) {
+		uint32_t childCount = 0;
+		for (uint32_t j = 0; j < modules.length; ++j) {
+			childCount += rewritten[(unsigned char)symbols[modules.start + j]];
+		}
+		children.resize(child + childCount);
+	}
+	nodes[node].childStart = child;
+	uint32_t parameter = modules.parameterStart;
+	float own[LMaxRegisters];
+	for (uint32_t j = 0; j < modules.length; ++j) {
+		const unsigned char c = (unsigned char)symbols[modules.start + j];
+		const unsigned int count = arity[c];
+		uint32_t derived = Leaf;
+		if (iteration < iterations && rewritten[c]) {
+			//copied out, since deriving grows parameters
+			if (count > 0) {
+				memcpy(own, parameters.data() + parameter, count * sizeof(float));
+			}
+			derived = DeriveModule(builder, (char)c, own, iteration);
+			children[child++] = derived;
+		}
+		else {
+			for (unsigned int d = iteration; d < iterations; ++d) {
+				++builder.positions[d];
+			}
+		}
+		if (derived == Leaf) {
+			expandedLength += 1;
+			expandedParameters += count;
+		}
+		else {
+			expandedLength += nodes[derived].expandedLength;
+			expandedParameters += nodes[derived].expandedParameters;
+		}
+		parameter += count;
+	}
+	nodes[node].expandedLength = expandedLength;
+	nodes[node].expandedParameters = expandedParameters;
+}
+
+uint64_t LDerivation::Length() const
+{
+	return nodes.empty() ? 0 : nodes[0].expandedLength;
+}
+
+size_t LDerivation::NodeCount() const
+{
+	return nodes.size();
+}
+
+void LDerivation::Flatten(LString& result) const
+{
+	result.symbols.clear();
+	result.parameters.clear();
+	if (nodes.empty()) {
+		return;
+	}
+	result.symbols.reserve((size_t)nodes[0].expandedLength);
+	result.parameters.reserve((size_t)nodes[0].expandedParameters);
+	Reader reader(*this);
+	char glyph;
+	const float* arguments;
+	unsigned int argumentCount;
+	while (reader.Next(glyph, arguments, argumentCount)) {
+		result.symbols += glyph;
+		result.parameters.insert(result.parameters.end(), arguments, arguments + argumentCount);
+	}
+}
+
+LDerivation::Reader::Reader(const LDerivation& derivation) : derivation(derivation)
+{
+	frames.reserve(derivation.iterations + 1);
+	if (!derivation.nodes.empty()) {
+		const Node& root = derivation.nodes[0];
+		frames.push_back({ 0, 0, root.childStart, root.parameterStart, derivation.iterations });
+	}
+}
+
+bool LDerivation::Reader::Next(char& glyph, const float*& arguments, unsigned int& argumentCount)
+{
+	while (!frames.empty()) {
+		Frame& frame = frames.back();
+		const Node& node = derivation.nodes[frame.node];
+		if (frame.next == node.length) {
+			frames.pop_back();
+			continue;
+		}
+		const char symbol = derivation.symbols[node.start + frame.next++];
+		const unsigned int count = derivation.arity[(unsigned char)symbol];
+		const float* own = derivation.parameters.data() + frame.parameter;
+		frame.parameter += count;
+		if (frame.remaining > 0 && derivation.rewritten[(unsigned char)symbol]) {
+			const uint32_t child = derivation.children[frame.child++];
+			if (child != Leaf) {
+				const Node& childNode = derivation.nodes[child];
+				const unsigned int remaining = frame.remaining - 1;
+				frames.push_back({ child, 0, childNode.childStart, childNode.parameterStart, remaining });
+				continue;
+			}
+		}
+		glyph = symbol;
+		arguments = own;
+		argumentCount = count;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "LString.h"
+
+class LSpecies;
+
+// A grown string stored as the tree of rewrites that produced it, with identical subtrees shared.
+// Each node is one module rewritten at some depth: the successor it became, that successor's
+// parameters, and a child for each of its modules that was rewritten further.  A subtree is shared
+// whenever its derivation involves no random choice, i.e. it depends only on the module's glyph,
+// parameters and remaining iterations, so deterministic species take memory proportional to their
+// distinct subtrees rather than their length.  Stochastic choices match Grow's exactly.
+// Contexts can't be resolved without the whole string, so this is for context-free species only.
+class LDerivation
+{
+private:
+	struct Node {
+		uint32_t start;              // its modules, a slice of symbols
+		uint32_t length;
+		uint32_t childStart;         // one entry in children per rewritten module
+		uint32_t parameterStart;     // its modules' parameters
+		uint64_t expandedLength;     // modules in its full expansion
+		uint64_t expandedParameters;
+	};
+	// Marks a rewritten module that stayed as it was, so has no node
+	static const uint32_t Leaf = UINT32_MAX;
+	// Successor glyphs are copied from the species, so a derivation outlives it; the axiom follows them
+	std::string symbols;
+	std::vector<Node> nodes;         // the root, whose modules are the axiom, is nodes[0]
+	std::vector<uint32_t> children;
+	std::vector<float> parameters;
+	bool rewritten[256];             // whether a glyph has a production, and so a child entry
+	uint8_t arity[256];
+	unsigned int iterations;
+
+	friend class LSpecies;
+	struct Builder;
+	// Derives species' string for iterations iterations from seed, replacing any previous contents
+	bool Derive(const LSpecies& species, int iterations, uint32_t seed);
+	uint32_t DeriveModule(Builder& builder, char glyph, const float* own, unsigned int iteration);
+	void DeriveModules(Builder& builder, uint32_t node, unsigned int iteration);
+
+public:
+	// Walks the derivation depth first, producing the modules of the grown string in order
+	class Reader
+	{
+	private:
+		struct Frame {
+			uint32_t node;
+			uint32_t next;          // next module within it
+			uint32_t child;         // next entry in children
+			uint32_t parameter;     // next module's parameters
+			unsigned int remaining; // iterations its modules still go through
+		};
+		const LDerivation& derivation;
+		std::vector<Frame> frames;
+
+	public:
+		Reader(const LDerivation& derivation);
+		// Produces the next module; arguments stay valid as long as the derivation does
+		bool Next(char& glyph, const float*& arguments, unsigned int& argumentCount);
+	};
+
+	LDerivation();
+	uint64_t Length() const;     // modules in the grown string
+	size_t NodeCount() const;
+	void Flatten(LString& result) const;
+};
@@ -0,0 +1,65 @@
+#include "LExpander.h"
+#include "LSpecies.h"
+#include "LSymbol.h"
+#include <cstring>
+
+LExpander::LExpander(const LSpecies& species, int iterations, uint32_t seed) :
+	species(species), iterations(iterations < 0 ? 0 : (unsigned int)iterations), seed(seed)
+{
+	positions.assign(this->iterations + 1, 0);
+	parameters = species.axiom.parameters;
+	frames.push_back({ species.axiom.symbols.data(), (unsigned int)species.axiom.symbols.size(), 0, 0, 0, 0 });
+}
+
+bool LExpander::Next(char& glyph, const float*& arguments, unsigned int& argumentCount)
+{
+	while (!frames.empty()) {
+		Frame& frame = frames.back();
+		if (frame.next == frame.length) {
+			parameters.resize(frame.parameterStart);
+			frames.pop_back();
+			continue;
+		}
+		const char symbol = frame.symbols[frame.next++];
+		const unsigned int count = species.arity[(unsigned char)symbol];
+		const size_t own = frame.parameterCursor;
+		const unsigned int depth = frame.depth;
+		frame.parameterCursor += count;
+		if (depth == iterations) {
+			if (ToSymbol(symbol) == LSymbol::Inert) {
+				continue;
+			}
+			glyph = symbol;
+			arguments = parameters.data() + own;
+			argumentCount = count;
+			return true;
+		}
+		const LSpecies::Alternative& alternative = species.SelectAlternative(symbol, parameters.data() + own, nullptr, nullptr, positions[depth]++, seed, depth);
+		if (species.IsIdentity(alternative)) {
+			//a module that isn't rewritten now never will be, since nothing it depends on changes,
+			//so it's passed straight through the remaining iterations without a frame per level
+			for (unsigned int d = depth + 1; d < iterations; ++d) {
+				++positions[d];
+			}
+			if (ToSymbol(symbol) == LSymbol::Inert) {
+				continue;
+			}
+			glyph = symbol;
+			arguments = parameters.data() + own;
+			argumentCount = count;
+			return true;
+		}
+		//evaluate the successor's parameters onto the stack; the actuals are copied out first
+		//since growing the stack can move them
+		float actuals[LMaxRegisters];
+		if (count > 0) {
+			memcpy(actuals, parameters.data() + own, count * sizeof(float));
+		}
+		const size_t parameterStart = parameters.size();
+		parameters.resize(parameterStart + alternative.parameterCount);
+		float* out = parameters.data() + parameterStart;
+		RunLBytecode(species.bytecode.data() + alternative.argumentStart, alternative.argumentLength, actuals, count, out);
+		frames.push_back({ species.successors.data() + alternative.start, alternative.length, 0, depth + 1, parameterStart, parameterStart });
+	}
+	return false;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class LSpecies;
+
+// Derives a species' grown string lazily, depth first: each call to Next rewrites just far enough
+// to produce the next module of the final iteration.  Only the successors on the current path are
+// held, so memory is O(iterations * longest successor) however large the tree gets.
+// Stochastic choices match Grow's exactly, since modules at each depth are still visited in order.
+// Contexts can't be resolved without the whole string, so this is for context-free species only.
+class LExpander
+{
+private:
+	struct Frame {
+		const char* symbols;         // the successor being walked
+		unsigned int length;
+		unsigned int next;           // next module within it
+		unsigned int depth;          // iteration that produced it
+		size_t parameterStart;       // its parameters within parameters
+		size_t parameterCursor;
+	};
+	const LSpecies& species;
+	unsigned int iterations;
+	uint32_t seed;
+	std::vector<Frame> frames;
+	std::vector<float> parameters; // parameters of each frame's successor, stacked
+	std::vector<uint64_t> positions; // modules rewritten so far at each depth, for stochastic seeding
+
+public:
+	LExpander(const LSpecies& species, int iterations, uint32_t seed);
+	// Produces the next module the turtle acts on; arguments stay valid until the next call
+	bool Next(char& glyph, const float*& arguments, unsigned int& argumentCount);
+};
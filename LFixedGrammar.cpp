@@ -0,0 +1,33 @@
+#include "LFixedGrammar.h"
+
+// The example in LFixedGrammar.h, expanded at compile time and compared with golden strings that
+// LSpecies::Grow gave for the same seeds.  LHash and LThreshold are shared with LSpecies, so these
+// catch a change to the walk: the iteration and position each module's draw is hashed with.  Grow's
+// side of that, in Rewrite, isn't compiled here, so a change to it needs these strings updated too.
+
+template <size_t Capacity>
+static constexpr bool LFixedEquals(const LFixedString<Capacity>& string, const char* expected)
+{
+	if (string.length != LFixedLength(expected)) {
+		return false;
+	}
+	for (size_t i = 0; i < string.length; ++i) {
+		if (string.symbols[i] != expected[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static constexpr LFixedProduction exampleTree[] = { { 'X', "F[-X]+X", 3.f }, { 'X', "F[<X]", 1.f } };
+
+static constexpr size_t exampleLength0 = LFixedDerive("X", exampleTree, 4, 0, nullptr, 0);
+static constexpr LFixedString<exampleLength0> exampleGrown0 = LFixedExpand<exampleLength0>("X", exampleTree, 4, 0);
+static_assert(exampleLength0 == 65, "LFixedDerive no longer matches its golden length");
+static_assert(LFixedEquals(exampleGrown0, "F[-F[-F[-F[-X]+X]+F[<X]]+F[-F[<X]]+F[-X]+X]+F[<F[-F[-X]+X]+F[<X]]"), "LFixedExpand no longer matches its golden string");
+
+//seed 4 picks the lighter alternative first
+static constexpr size_t exampleLength4 = LFixedDerive("X", exampleTree, 4, 4, nullptr, 0);
+static constexpr LFixedString<exampleLength4> exampleGrown4 = LFixedExpand<exampleLength4>("X", exampleTree, 4, 4);
+static_assert(exampleLength4 == 37, "LFixedDerive no longer matches its golden length");
+static_assert(LFixedEquals(exampleGrown4, "F[<F[-F[<F[-X]+X]]+F[-F[<X]]+F[-X]+X]"), "LFixedExpand no longer matches its golden string");
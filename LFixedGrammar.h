@@ -0,0 +1,131 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "LHash.h"
+#include "LString.h"
+
+// Grammars fixed at build time, expanded by the compiler so shipping them costs nothing at startup.
+// Only context-free, non-parametric productions are supported, written without spaces.  Given the
+// same productions in the same order, the expansion is what LSpecies::Grow produces for the same
+// seed, as both draw alternatives with LHash and LThreshold, so the result can be handed straight
+// to LSpecies::Build:
+//
+//   static constexpr LFixedProduction tree[] = { { 'X', "F[-X]+X", 3.f }, { 'X', "F[<X]", 1.f } };
+//   static constexpr size_t treeLength = LFixedDerive("X", tree, 4, seed, nullptr, 0);
+//   static constexpr LFixedString<treeLength> grown = LFixedExpand<treeLength>("X", tree, 4, seed);
+//   species->Build(grown.ToLString(), device, context);
+//
+// Game doesn't use it: its trees are read from Trees.lsys so they can be edited without a rebuild,
+// and growing them at startup takes well under a millisecond.  LFixedGrammar.cpp pins the example
+// above to golden strings taken from LSpecies::Grow, which catches a change to how either numbers
+// the modules it draws for.
+struct LFixedProduction {
+	char predecessor;
+	const char* successor;
+	float weight;
+};
+
+template <size_t Capacity>
+struct LFixedString {
+	char symbols[Capacity > 0 ? Capacity : 1];
+	size_t length;
+
+	constexpr LFixedString() : symbols(), length(0) {};
+	LString ToLString() const {
+		LString string;
+		string.symbols.assign(symbols, length);
+		return string;
+	}
+};
+
+// Deepest iteration count LFixedDerive supports, bounding its stack
+const int LFixedMaxIterations = 32;
+
+constexpr size_t LFixedLength(const char* text) {
+	size_t length = 0;
+	while (text[length] != '\0') {
+		++length;
+	}
+	return length;
+}
+
+// Index of the production rewriting symbol, or -1 to keep it.  Draws as LSpecies::SelectAlternative
+// does for an unconditional symbol, against the thresholds CompileProductions stores, both from
+// LThreshold, so each draw lands on the same alternative.
+template <size_t N>
+constexpr int LFixedSelect(const LFixedProduction (&productions)[N], char symbol, uint32_t seed, uint32_t iteration, uint64_t position) {
+	float totalWeight = 0;
+	int count = 0;
+	int chosen = -1;
+	for (size_t i = 0; i < N; ++i) {
+		if (productions[i].predecessor == symbol) {
+			totalWeight += productions[i].weight;
+			++count;
+			chosen = (int)i;
+		}
+	}
+	if (totalWeight <= 0 || count == 1) {
+		return totalWeight <= 0 ? -1 : chosen;
+	}
+	const uint32_t roll = LHash(seed, iteration, position);
+	float cumulativeWeight = 0;
+	int seen = 0;
+	for (size_t i = 0; i < N; ++i) {
+		if (productions[i].predecessor != symbol) {
+			continue;
+		}
+		cumulativeWeight += productions[i].weight;
+		++seen;
+		if (roll < LThreshold(cumulativeWeight, totalWeight, seen == count)) {
+			return (int)i;
+		}
+	}
+	return chosen;
+}
+
+// Derives depth first, like LExpander, writing up to capacity symbols of the result to out (which
+// may be null) and returning its full length, so it can also size the LFixedString first
+template <size_t N>
+constexpr size_t LFixedDerive(const char* axiom, const LFixedProduction (&productions)[N], int iterations, uint32_t seed, char* out, size_t capacity) {
+	const char* frameSymbols[LFixedMaxIterations + 1] = {};
+	size_t frameLength[LFixedMaxIterations + 1] = {};
+	size_t frameNext[LFixedMaxIterations + 1] = {};
+	uint64_t positions[LFixedMaxIterations + 1] = {};
+	iterations = iterations < 0 ? 0 : iterations > LFixedMaxIterations ? LFixedMaxIterations : iterations;
+	size_t written = 0;
+	int depth = 0;
+	frameSymbols[0] = axiom;
+	frameLength[0] = LFixedLength(axiom);
+	while (depth >= 0) {
+		if (frameNext[depth] == frameLength[depth]) {
+			--depth;
+			continue;
+		}
+		const char symbol = frameSymbols[depth][frameNext[depth]++];
+		const int chosen = depth == iterations ? -1 : LFixedSelect(productions, symbol, seed, (uint32_t)depth, positions[depth]++);
+		if (chosen < 0) {
+			//kept as is through every remaining iteration
+			for (int d = depth + 1; d < iterations; ++d) {
+				++positions[d];
+			}
+			if (out != nullptr && written < capacity) {
+				out[written] = symbol;
+			}
+			++written;
+			continue;
+		}
+		++depth;
+		frameSymbols[depth] = productions[chosen].successor;
+		frameLength[depth] = LFixedLength(productions[chosen].successor);
+		frameNext[depth] = 0;
+	}
+	return written;
+}
+
+template <size_t Capacity, size_t N>
+constexpr LFixedString<Capacity> LFixedExpand(const char* axiom, const LFixedProduction (&productions)[N], int iterations, uint32_t seed) {
+	LFixedString<Capacity> result;
+	const size_t length = LFixedDerive(axiom, productions, iterations, seed, result.symbols, Capacity);
+	result.length = length < Capacity ? length : Capacity;
+	return result;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// Counter-based hash used for stochastic productions.  The result depends only on its inputs,
+// so any symbol of any iteration can pick its production independently of every other one,
+// on any thread, and a given seed always grows exactly the same tree, even at compile time.
+constexpr uint32_t LHash(uint32_t seed, uint32_t iteration, uint64_t position) {
+	//splitmix64 finalizer over the packed counter
+	uint64_t x = position ^ ((uint64_t)seed << 32 | iteration) * 0x9E3779B97F4A7C15ull;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	x ^= x >> 31;
+	return (uint32_t)(x >> 32);
+}
+
+// Threshold of a stochastic alternative: a roll of LHash below it picks this alternative, if no
+// earlier one took it.  cumulativeWeight is the weight of this alternative and every one before it
+// out of totalWeight; the last takes every roll left.  Shared by LSpecies and LFixedGrammar so
+// both draw the same alternatives.
+constexpr uint32_t LThreshold(float cumulativeWeight, float totalWeight, bool last) {
+	const double fraction = cumulativeWeight / totalWeight;
+	return last || fraction >= 1.0 ? UINT32_MAX : (uint32_t)(fraction * 4294967296.0);
+}
+
+// FNV-1a over a block of bytes, continuing from hash (start from LHashBytesBasis), for naming
+// cached results by their inputs
+const uint64_t LHashBytesBasis = 0xCBF29CE484222325ull;
+inline uint64_t LHashBytes(uint64_t hash, const void* data, size_t length) {
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < length; ++i) {
+		hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+	}
+	return hash;
+}
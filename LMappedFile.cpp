@@ -0,0 +1,96 @@
+#include "LMappedFile.h"
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fstream>
+#endif
+
+LMappedFile::LMappedFile() : data(nullptr), size(0)
+#ifdef _WIN32
+	, file(INVALID_HANDLE_VALUE), mapping(nullptr)
+#endif
+{
+}
+
+LMappedFile::~LMappedFile()
+{
+	Close();
+}
+
+bool LMappedFile::Open(const std::string& path)
+{
+	Close();
+#ifdef _WIN32
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize)) {
+		Close();
+		return false;
+	}
+	size = (size_t)fileSize.QuadPart;
+	if (size == 0) {
+		//empty files can't be mapped, but there's nothing to read anyway
+		static const char empty = 0;
+		data = &empty;
+		return true;
+	}
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr) {
+		Close();
+		return false;
+	}
+	data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == nullptr) {
+		Close();
+		return false;
+	}
+#else
+	std::ifstream in(path, std::ios::binary | std::ios::ate);
+	if (!in.is_open()) {
+		return false;
+	}
+	contents.resize((size_t)in.tellg());
+	in.seekg(0);
+	if (!in.read(contents.data(), contents.size())) {
+		contents.clear();
+		return false;
+	}
+	data = contents.data();
+	size = contents.size();
+#endif
+	return true;
+}
+
+void LMappedFile::Close()
+{
+#ifdef _WIN32
+	if (mapping != nullptr) {
+		if (data != nullptr) {
+			UnmapViewOfFile(data);
+		}
+		CloseHandle(mapping);
+		mapping = nullptr;
+	}
+	if (file != INVALID_HANDLE_VALUE) {
+		CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+	}
+#else
+	contents.clear();
+#endif
+	data = nullptr;
+	size = 0;
+}
+
+const char* LMappedFile::Data() const
+{
+	return data;
+}
+
+size_t LMappedFile::Size() const
+{
+	return size;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// A read-only view of a whole file.  On Windows the file is memory-mapped, so pages are only read
+// as they're touched; elsewhere it's read into memory up front.
+class LMappedFile
+{
+private:
+	const char* data;
+	size_t size;
+#ifdef _WIN32
+	void* file;
+	void* mapping;
+#else
+	std::vector<char> contents;
+#endif
+
+public:
+	LMappedFile();
+	~LMappedFile();
+	LMappedFile(const LMappedFile&) = delete;
+	LMappedFile& operator=(const LMappedFile&) = delete;
+	bool Open(const std::string& path); //false if the file can't be read
+	void Close();
+	const char* Data() const;
+	size_t Size() const;
+};
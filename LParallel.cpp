@@ -0,0 +1,76 @@
+#include "LParallel.h"
+#include <algorithm>
+
+LThreadPool& LThreadPool::Shared()
+{
+	static LThreadPool pool;
+	return pool;
+}
+
+LThreadPool::~LThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+void LThreadPool::Job::Work()
+{
+	for (unsigned int i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+		(*task)(i);
+	}
+}
+
+void LThreadPool::Run(unsigned int count, unsigned int maxThreads, const std::function<void(unsigned int)>& task)
+{
+	Job job;
+	job.task = &task;
+	job.count = count;
+	job.next = 0;
+	job.helpers = maxThreads > 1 ? maxThreads - 1 : 0;
+	job.working = 0;
+	if (job.helpers > 0) {
+		std::lock_guard<std::mutex> lock(mutex);
+		//only ever grows to the most helpers any one run has asked for
+		while (workers.size() < job.helpers) {
+			workers.emplace_back(&LThreadPool::Work, this);
+		}
+		jobs.push_back(&job);
+	}
+	wake.notify_all();
+	job.Work();
+	//every task has been taken; once no worker is still on one, they've all finished
+	std::unique_lock<std::mutex> lock(mutex);
+	const auto queued = std::find(jobs.begin(), jobs.end(), &job);
+	if (queued != jobs.end()) {
+		jobs.erase(queued);
+	}
+	done.wait(lock, [&job]() { return job.working == 0; });
+}
+
+void LThreadPool::Work()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+		if (stopping) {
+			return;
+		}
+		Job* job = jobs.front();
+		if (--job->helpers == 0) {
+			jobs.pop_front();
+		}
+		++job->working;
+		lock.unlock();
+		job->Work();
+		lock.lock();
+		if (--job->working == 0) {
+			done.notify_all();
+		}
+	}
+}
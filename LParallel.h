@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Worker threads shared by every species, started the first time they're needed and kept for the
+// life of the process, so Grow and Build don't start threads of their own on every pass
+class LThreadPool {
+public:
+	static LThreadPool& Shared();
+	~LThreadPool();
+	// Runs task(i) for every i in [0, count) on up to maxThreads threads, the calling one included,
+	// each taking the next i as it finishes one so uneven tasks even out.  Returns once every task
+	// has finished.  Runs from several threads at once, or from inside a task, share the workers.
+	void Run(unsigned int count, unsigned int maxThreads, const std::function<void(unsigned int)>& task);
+
+private:
+	struct Job {
+		const std::function<void(unsigned int)>* task;
+		unsigned int count;
+		std::atomic<unsigned int> next;
+		unsigned int helpers; // workers that may still join, under mutex
+		unsigned int working; // workers in it now, under mutex
+		void Work();
+	};
+	std::mutex mutex;
+	std::condition_variable wake; // a job was queued, or the pool is stopping
+	std::condition_variable done; // a worker left a job
+	std::deque<Job*> jobs;        // waiting for helpers
+	std::vector<std::thread> workers;
+	bool stopping = false;
+
+	void Work();
+};
+
+// Runs task(i) for every i in [0, count), spread over up to maxThreads threads including the
+// calling one.  Returns once every task has finished.
+template <class Task>
+void ParallelFor(unsigned int count, unsigned int maxThreads, const Task& task)
+{
+	const unsigned int numThreads = count < maxThreads ? count : maxThreads;
+	if (numThreads <= 1) {
+		for (unsigned int i = 0; i < count; ++i) {
+			task(i);
+		}
+		return;
+	}
+	LThreadPool::Shared().Run(count, numThreads, std::function<void(unsigned int)>(std::cref(task)));
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <string>
+
+// A single rewriting rule.  The predecessor is one module, optionally naming formal parameters
+// ("F(l,w)"); the successor is a string of modules whose parameters are expressions over those
+// formals ("F(l*0.8,w)[+(0.5)X(l)]"); the optional condition must be nonzero for the rule to apply.
+// A rule can also require the module before and/or after the predecessor to be a given one
+// (leftContext/rightContext, each a single module whose formals are usable too).  Context is
+// matched along branches, skipping bracketed side branches and the turn and decay commands.
+// Several productions sharing a predecessor are stochastic alternatives, picked in proportion to weight
+// from among those whose context and condition hold.
+struct LProduction {
+	std::string leftContext;
+	std::string predecessor;
+	std::string rightContext;
+	std::string condition;
+	std::string successor;
+	float weight;
+	LProduction(char predecessor, std::string successor, float weight = 1.f) :
+		predecessor(1, predecessor), successor(successor), weight(weight) {};
+	LProduction(std::string predecessor, std::string condition, std::string successor, float weight = 1.f) :
+		predecessor(predecessor), condition(condition), successor(successor), weight(weight) {};
+	LProduction(std::string leftContext, std::string predecessor, std::string rightContext, std::string condition, std::string successor, float weight = 1.f) :
+		leftContext(leftContext), predecessor(predecessor), rightContext(rightContext), condition(condition), successor(successor), weight(weight) {};
+};
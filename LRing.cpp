@@ -0,0 +1,95 @@
+#include "LRing.h"
+#include "LScan.h"
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define LRING_X86
+#endif
+
+const unsigned int LRing::MaxSides;
+
+LRing::LRing(unsigned int sides) : sides(sides < 3 ? 3 : sides > MaxSides ? MaxSides : sides), cosines(), sines()
+{
+	const double step = 6.283185307179586 / this->sides;
+	for (unsigned int j = 0; j < this->sides; ++j) {
+		cosines[j] = (float)cos(step * j);
+		sines[j] = (float)sin(step * j);
+	}
+}
+
+unsigned int LRing::Sides() const
+{
+	return sides;
+}
+
+float LRing::Cosine(unsigned int side) const
+{
+	return cosines[side];
+}
+
+float LRing::Sine(unsigned int side) const
+{
+	return sines[side];
+}
+
+static void PlaceScalar(const float* cosines, const float* sines, unsigned int sides, const float* right, const float* up, LRing::Offsets& offsets)
+{
+	for (unsigned int j = 0; j < sides; ++j) {
+		offsets.x[j] = right[0] * cosines[j] + up[0] * sines[j];
+		offsets.y[j] = right[1] * cosines[j] + up[1] * sines[j];
+		offsets.z[j] = right[2] * cosines[j] + up[2] * sines[j];
+	}
+}
+
+#ifdef LRING_X86
+static void PlaceSSE2(const float* cosines, const float* sines, unsigned int sides, const float* right, const float* up, LRing::Offsets& offsets)
+{
+	float* out[3] = { offsets.x, offsets.y, offsets.z };
+	for (int axis = 0; axis < 3; ++axis) {
+		const __m128 r = _mm_set1_ps(right[axis]);
+		const __m128 u = _mm_set1_ps(up[axis]);
+		for (unsigned int j = 0; j < sides; j += 4) {
+			const __m128 offset = _mm_add_ps(_mm_mul_ps(r, _mm_loadu_ps(cosines + j)), _mm_mul_ps(u, _mm_loadu_ps(sines + j)));
+			_mm_storeu_ps(out[axis] + j, offset);
+		}
+	}
+}
+
+// Like LScan's, only ever run once the CPU check has passed, and clearing the upper halves of the YMM
+// registers before the turtle's SSE code runs again
+static void PlaceAVX2(const float* cosines, const float* sines, unsigned int sides, const float* right, const float* up, LRing::Offsets& offsets)
+{
+	float* out[3] = { offsets.x, offsets.y, offsets.z };
+	for (int axis = 0; axis < 3; ++axis) {
+		const __m256 r = _mm256_set1_ps(right[axis]);
+		const __m256 u = _mm256_set1_ps(up[axis]);
+		for (unsigned int j = 0; j < sides; j += 8) {
+			const __m256 offset = _mm256_add_ps(_mm256_mul_ps(r, _mm256_loadu_ps(cosines + j)), _mm256_mul_ps(u, _mm256_loadu_ps(sines + j)));
+			_mm256_storeu_ps(out[axis] + j, offset);
+		}
+	}
+	_mm256_zeroupper();
+}
+#endif
+
+void LRing::Place(const float right[3], const float up[3], float radius, Offsets& offsets) const
+{
+	const float r[3] = { right[0] * radius, right[1] * radius, right[2] * radius };
+	const float u[3] = { up[0] * radius, up[1] * radius, up[2] * radius };
+	//the vector paths fill whole registers, which the padding of both the template and offsets allows
+	switch (LGetScanLevel())
+	{
+#ifdef LRING_X86
+	case LScanLevel::AVX2:
+		PlaceAVX2(cosines, sines, sides, r, u, offsets);
+		break;
+	case LScanLevel::SSE2:
+		PlaceSSE2(cosines, sines, sides, r, u, offsets);
+		break;
+#endif
+	default:
+		PlaceScalar(cosines, sines, sides, r, u, offsets);
+		break;
+	}
+}
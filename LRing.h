@@ -0,0 +1,32 @@
+#pragma once
+
+// Cross-section of a branch: the unit circle sampled at a fixed number of sides, computed once so
+// building a mesh never evaluates a sine or builds a rotation.  Each ring is then the turtle's frame
+// applied to the template, offset = radius * (right * cos + up * sin), which is the same point
+// rotating right about forward by each side's angle gives.
+class LRing
+{
+public:
+	static const unsigned int MaxSides = 32;
+	// Offsets of a ring's vertices from its center, one array per axis so whole rings are computed
+	// a vector register at a time (8 sides is exactly one AVX register)
+	struct Offsets {
+		float x[MaxSides];
+		float y[MaxSides];
+		float z[MaxSides];
+	};
+
+	explicit LRing(unsigned int sides); //clamped to [3, MaxSides]
+	unsigned int Sides() const;
+	float Cosine(unsigned int side) const;
+	float Sine(unsigned int side) const;
+	// right and up must be unit length and perpendicular to the branch's direction
+	void Place(const float right[3], const float up[3], float radius, Offsets& offsets) const;
+
+private:
+	unsigned int sides;
+	//padded to whole AVX registers so the vector paths never need a tail.  Rings are kept in vectors,
+	//which needn't align to more than 16 bytes, so they're loaded unaligned.
+	float cosines[MaxSides];
+	float sines[MaxSides];
+};
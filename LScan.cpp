@@ -0,0 +1,222 @@
+#include "LScan.h"
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define LSCAN_X86
+#endif
+
+bool LGlyphSet::Add(char glyph)
+{
+	if (Contains(glyph)) {
+		return true;
+	}
+	if (count == MaxGlyphs) {
+		return false;
+	}
+	glyphs[count++] = glyph;
+	member[(unsigned char)glyph] = true;
+	return true;
+}
+
+bool LGlyphSet::Contains(char glyph) const
+{
+	return member[(unsigned char)glyph];
+}
+
+static size_t FindFirstOfScalar(const char* symbols, size_t length, const LGlyphSet& set)
+{
+	for (size_t i = 0; i < length; ++i) {
+		if (set.member[(unsigned char)symbols[i]]) {
+			return i;
+		}
+	}
+	return length;
+}
+
+static size_t CountOfScalar(const char* symbols, size_t length, char glyph)
+{
+	size_t count = 0;
+	for (size_t i = 0; i < length; ++i) {
+		count += symbols[i] == glyph;
+	}
+	return count;
+}
+
+#ifdef LSCAN_X86
+static size_t FindFirstOfSSE2(const char* symbols, size_t length, const LGlyphSet& set)
+{
+	__m128i targets[LGlyphSet::MaxGlyphs];
+	for (unsigned int g = 0; g < set.count; ++g) {
+		targets[g] = _mm_set1_epi8(set.glyphs[g]);
+	}
+	size_t i = 0;
+	for (; i + 16 <= length; i += 16) {
+		const __m128i block = _mm_loadu_si128((const __m128i*)(symbols + i));
+		__m128i hits = _mm_setzero_si128();
+		for (unsigned int g = 0; g < set.count; ++g) {
+			hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, targets[g]));
+		}
+		const unsigned long mask = (unsigned long)_mm_movemask_epi8(hits);
+		if (mask != 0) {
+			unsigned long first;
+			_BitScanForward(&first, mask);
+			return i + first;
+		}
+	}
+	return i + FindFirstOfScalar(symbols + i, length - i, set);
+}
+
+static size_t CountOfSSE2(const char* symbols, size_t length, char glyph)
+{
+	const __m128i target = _mm_set1_epi8(glyph);
+	size_t count = 0;
+	size_t i = 0;
+	for (; i + 16 <= length; i += 16) {
+		const __m128i block = _mm_loadu_si128((const __m128i*)(symbols + i));
+		count += __popcnt((unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(block, target)));
+	}
+	return count + CountOfScalar(symbols + i, length - i, glyph);
+}
+
+// MSVC accepts AVX2 intrinsics without /arch:AVX2, so these only ever run once the CPU check has passed.
+// The rest of the file is SSE2 without VEX encoding, so they clear the upper halves of the YMM
+// registers before handing over to it or returning, or every SSE instruction after them stalls.
+static size_t FindFirstOfAVX2(const char* symbols, size_t length, const LGlyphSet& set)
+{
+	__m256i targets[LGlyphSet::MaxGlyphs];
+	for (unsigned int g = 0; g < set.count; ++g) {
+		targets[g] = _mm256_set1_epi8(set.glyphs[g]);
+	}
+	size_t i = 0;
+	for (; i + 32 <= length; i += 32) {
+		const __m256i block = _mm256_loadu_si256((const __m256i*)(symbols + i));
+		__m256i hits = _mm256_setzero_si256();
+		for (unsigned int g = 0; g < set.count; ++g) {
+			hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, targets[g]));
+		}
+		const unsigned long mask = (unsigned long)(unsigned int)_mm256_movemask_epi8(hits);
+		if (mask != 0) {
+			unsigned long first;
+			_BitScanForward(&first, mask);
+			_mm256_zeroupper();
+			return i + first;
+		}
+	}
+	_mm256_zeroupper();
+	return i + FindFirstOfSSE2(symbols + i, length - i, set);
+}
+
+static size_t CountOfAVX2(const char* symbols, size_t length, char glyph)
+{
+	const __m256i target = _mm256_set1_epi8(glyph);
+	size_t count = 0;
+	size_t i = 0;
+	for (; i + 32 <= length; i += 32) {
+		const __m256i block = _mm256_loadu_si256((const __m256i*)(symbols + i));
+		count += __popcnt((unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, target)));
+	}
+	_mm256_zeroupper();
+	return count + CountOfSSE2(symbols + i, length - i, glyph);
+}
+
+static bool CPUSupportsAVX2()
+{
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+	//AVX2 needs the OS to save the YMM registers (OSXSAVE + XCR0) as well as the CPU feature bit
+	__cpuid(info, 1);
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+	const bool popcnt = (info[2] & (1 << 23)) != 0;
+	if (!osxsave || !avx || !popcnt || (_xgetbv(0) & 6) != 6) {
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+}
+
+static bool CPUSupportsSSE2()
+{
+	//SSE2 is part of x64; the popcount we pair it with isn't, quite
+	int info[4];
+	__cpuid(info, 1);
+	return (info[3] & (1 << 26)) != 0 && (info[2] & (1 << 23)) != 0;
+}
+#endif
+
+static LScanLevel BestScanLevel()
+{
+#ifdef LSCAN_X86
+	if (CPUSupportsAVX2()) {
+		return LScanLevel::AVX2;
+	}
+	if (CPUSupportsSSE2()) {
+		return LScanLevel::SSE2;
+	}
+#endif
+	return LScanLevel::Scalar;
+}
+
+static const LScanLevel bestScanLevel = BestScanLevel();
+static LScanLevel scanLevel = bestScanLevel;
+
+size_t LFindFirstOf(const char* symbols, size_t length, const LGlyphSet& set)
+{
+	switch (scanLevel)
+	{
+#ifdef LSCAN_X86
+	case LScanLevel::AVX2:
+		return FindFirstOfAVX2(symbols, length, set);
+	case LScanLevel::SSE2:
+		return FindFirstOfSSE2(symbols, length, set);
+#endif
+	default:
+		return FindFirstOfScalar(symbols, length, set);
+	}
+}
+
+size_t LCountOf(const char* symbols, size_t length, char glyph)
+{
+	switch (scanLevel)
+	{
+#ifdef LSCAN_X86
+	case LScanLevel::AVX2:
+		return CountOfAVX2(symbols, length, glyph);
+	case LScanLevel::SSE2:
+		return CountOfSSE2(symbols, length, glyph);
+#endif
+	default:
+		return CountOfScalar(symbols, length, glyph);
+	}
+}
+
+LScanLevel LGetScanLevel()
+{
+	return scanLevel;
+}
+
+bool LSetScanLevel(LScanLevel level)
+{
+	if ((int)level > (int)bestScanLevel) {
+		return false;
+	}
+	scanLevel = level;
+	return true;
+}
+
+const char* LScanLevelName(LScanLevel level)
+{
+	switch (level)
+	{
+	case LScanLevel::AVX2:
+		return "AVX2";
+	case LScanLevel::SSE2:
+		return "SSE2";
+	default:
+		return "scalar";
+	}
+}
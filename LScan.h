@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+
+// Vectorized scans over grown symbol strings.  The widest implementation the CPU supports
+// (AVX2, then SSE2, then plain C++) is picked once at startup.
+enum class LScanLevel {
+	Scalar,
+	SSE2,
+	AVX2
+};
+
+// A small set of glyphs to scan for.  Each glyph costs one compare per block, so sets are
+// capped; anything larger should fall back to a lookup table.
+struct LGlyphSet {
+	static const unsigned int MaxGlyphs = 16;
+	char glyphs[MaxGlyphs];
+	unsigned int count;
+	bool member[256]; // for the scalar path and tails
+
+	LGlyphSet() : glyphs(), count(0), member() {};
+	bool Add(char glyph);
+	bool Contains(char glyph) const;
+};
+
+// Offset of the first symbol in [symbols, symbols + length) that's in set, or length if none is
+size_t LFindFirstOf(const char* symbols, size_t length, const LGlyphSet& set);
+// Number of times glyph occurs in [symbols, symbols + length)
+size_t LCountOf(const char* symbols, size_t length, char glyph);
+
+LScanLevel LGetScanLevel();
+// Forces a narrower implementation, e.g. for benchmarking.  Returns false, changing nothing, if the CPU can't run level.
+bool LSetScanLevel(LScanLevel level);
+const char* LScanLevelName(LScanLevel level);
@@ -1,144 +1,2165 @@
 #include "LSpecies.h"
 #include "LState.h"
+#include "LSymbol.h"
+#include "LHash.h"
+#include "LExpander.h"
+#include "LParallel.h"
+#include "LRing.h"
 #include "Vertex.h"
 #include <vector>
+#include <cstring>
+#include <cctype>
+#include <cstdio>
+#include <thread>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
 
 //
-LSpecies::LSpecies(std::function<std::string(std::string)> iterator, std::string axiom, float deltaInclination, float deltaAzimuth, float initialThickness, float thicknessDecay, float initialLimbLength, float limbLengthDecay) {
-	this->iterator = iterator;
-	this->axiom = axiom;
+LSpecies::LSpecies(const std::vector<LProduction>& productions, std::string axiom, float deltaInclination, float deltaAzimuth, float initialThickness, float thicknessDecay, float initialLimbLength, float limbLengthDecay) {
+	CompileProductions(productions, axiom);
+	CompileGrowth();
+	SetGrowThreads(std::thread::hardware_concurrency());
+	SetBuildThreads(std::thread::hardware_concurrency());
+	buildStreams = false;
+	//every field is hashed with its terminator so adjacent fields can't run together
+	sourceHash = LHashBytes(LHashBytesBasis, axiom.c_str(), axiom.size() + 1);
+	for (const LProduction& production : productions) {
+		const std::string* fields[5] = { &production.leftContext, &production.predecessor, &production.rightContext, &production.condition, &production.successor };
+		for (const std::string* field : fields) {
+			sourceHash = LHashBytes(sourceHash, field->c_str(), field->size() + 1);
+		}
+		sourceHash = LHashBytes(sourceHash, &production.weight, sizeof(production.weight));
+	}
+	growCacheSeed = 0;
+	growBudget = 0;
 	this->deltaInclination = deltaInclination;
 	this->deltaAzimuth = deltaAzimuth;
 	this->thicknessDecay = thicknessDecay;
 	this->limbLengthDecay = limbLengthDecay;
 	this->initialLimbLength = initialLimbLength;
 	this->initialThickness = initialThickness;
+	CompileTurns();
+}
+
+LSpecies::LSpecies() {
+	SetGrowThreads(std::thread::hardware_concurrency());
+	SetBuildThreads(std::thread::hardware_concurrency());
+	buildStreams = false;
+	growCacheSeed = 0;
+	growBudget = 0;
+}
+
+// Each table is written as its element count followed by its raw bytes
+template <class T>
+static void WriteTable(std::ostream& out, const T* data, size_t count)
+{
+	const uint64_t count64 = count;
+	out.write((const char*)&count64, sizeof(count64));
+	out.write((const char*)data, count * sizeof(T));
+}
+
+template <class T>
+static bool ReadTable(const char*& cursor, const char* end, T* data, size_t count)
+{
+	uint64_t count64;
+	if ((size_t)(end - cursor) < sizeof(count64)) {
+		return false;
+	}
+	memcpy(&count64, cursor, sizeof(count64));
+	cursor += sizeof(count64);
+	if (count64 != count || (size_t)(end - cursor) / sizeof(T) < count) {
+		return false;
+	}
+	if (count > 0) {
+		memcpy(data, cursor, count * sizeof(T));
+	}
+	cursor += count * sizeof(T);
+	return true;
+}
+
+template <class Container>
+static bool ReadTable(const char*& cursor, const char* end, Container& data)
+{
+	uint64_t count64;
+	if ((size_t)(end - cursor) < sizeof(count64)) {
+		return false;
+	}
+	memcpy(&count64, cursor, sizeof(count64));
+	if ((uint64_t)(end - cursor - sizeof(count64)) / sizeof(data[0]) < count64) {
+		return false;
+	}
+	data.resize((size_t)count64);
+	return ReadTable(cursor, end, data.empty() ? nullptr : &data[0], data.size());
+}
+
+void LSpecies::WriteCompiled(std::ostream& out) const {
+	//the tables are raw structs, so a build that lays them out differently must recompile
+	const uint32_t layout[2] = { (uint32_t)sizeof(Alternative), (uint32_t)sizeof(LInstruction) };
+	const float settings[6] = { deltaInclination, deltaAzimuth, initialThickness, thicknessDecay, initialLimbLength, limbLengthDecay };
+	WriteTable(out, layout, 2);
+	WriteTable(out, &sourceHash, 1);
+	WriteTable(out, successors.data(), successors.size());
+	WriteTable(out, alternatives.data(), alternatives.size());
+	WriteTable(out, bytecode.data(), bytecode.size());
+	WriteTable(out, alternativeStart, 256);
+	WriteTable(out, alternativeCount, 256);
+	WriteTable(out, arity, 256);
+	WriteTable(out, axiom.symbols.data(), axiom.symbols.size());
+	WriteTable(out, axiom.parameters.data(), axiom.parameters.size());
+	WriteTable(out, settings, 6);
+}
+
+LSpecies* LSpecies::ReadCompiled(const char*& cursor, const char* end) {
+	LSpecies* species = new LSpecies();
+	uint32_t layout[2];
+	float settings[6];
+	const bool ok = ReadTable(cursor, end, layout, 2) && layout[0] == sizeof(Alternative) && layout[1] == sizeof(LInstruction) &&
+		ReadTable(cursor, end, &species->sourceHash, 1) &&
+		ReadTable(cursor, end, species->successors) &&
+		ReadTable(cursor, end, species->alternatives) &&
+		ReadTable(cursor, end, species->bytecode) &&
+		ReadTable(cursor, end, species->alternativeStart, 256) &&
+		ReadTable(cursor, end, species->alternativeCount, 256) &&
+		ReadTable(cursor, end, species->arity, 256) &&
+		ReadTable(cursor, end, species->axiom.symbols) &&
+		ReadTable(cursor, end, species->axiom.parameters) &&
+		ReadTable(cursor, end, settings, 6);
+	//a well-formed file can still index out of its tables if it's corrupt, so check every slice and
+	//count, working out what's derived from the tables (flags, conditional and the scan) along the way
+	if (!ok || !species->CheckCompiled()) {
+		delete species;
+		return nullptr;
+	}
+	species->deltaInclination = settings[0];
+	species->deltaAzimuth = settings[1];
+	species->initialThickness = settings[2];
+	species->thicknessDecay = settings[3];
+	species->initialLimbLength = settings[4];
+	species->limbLengthDecay = settings[5];
+	species->CompileGrowth();
+	species->CompileTurns();
+	return species;
+}
+
+// Whether code only uses opcodes RunLBytecode knows, counting the parameters it emits.  Operands
+// are bytes, so they can't address past its registers.
+static bool CheckBytecode(const LInstruction* code, unsigned int length, unsigned int& emitted)
+{
+	static_assert(LMaxRegisters > UINT8_MAX, "every register operand has to be in range");
+	emitted = 0;
+	for (unsigned int i = 0; i < length; ++i) {
+		if (code[i].op > LOpcode::Emit) {
+			return false;
+		}
+		emitted += code[i].op == LOpcode::Emit ? 1 : 0;
+	}
+	return true;
+}
+
+bool LSpecies::CheckCompiled() {
+	if (successors.size() < 256 || alternatives.size() < 256) {
+		return false;
+	}
+	uint64_t axiomParameters = 0;
+	for (char glyph : axiom.symbols) {
+		axiomParameters += arity[(unsigned char)glyph];
+	}
+	if (axiomParameters != axiom.parameters.size()) {
+		return false;
+	}
+	parametric = false;
+	contextSensitive = false;
+	for (unsigned int c = 0; c < 256; ++c) {
+		parametric |= arity[c] != 0;
+		//a symbol without a production has just its identity, which IsIdentity knows by where it is
+		const Alternative& identity = alternatives[c];
+		unsigned int emitted;
+		if (successors[c] != (char)c || identity.start != c || identity.length != 1 || identity.parameterCount != arity[c] ||
+			identity.conditionLength != 0 || identity.leftContext != 0 || identity.rightContext != 0 ||
+			(uint64_t)identity.argumentStart + identity.argumentLength > bytecode.size() ||
+			!CheckBytecode(bytecode.data() + identity.argumentStart, identity.argumentLength, emitted) || emitted != arity[c]) {
+			return false;
+		}
+		const bool rewritten = alternativeStart[c] != c;
+		if (alternativeCount[c] == 0 || (!rewritten && alternativeCount[c] != 1) || (rewritten && alternativeStart[c] < 256) ||
+			(uint64_t)alternativeStart[c] + alternativeCount[c] > alternatives.size()) {
+			return false;
+		}
+		conditional[c] = false;
+		for (unsigned int k = alternativeStart[c]; k < alternativeStart[c] + alternativeCount[c] && rewritten; ++k) {
+			const Alternative& alternative = alternatives[k];
+			if ((uint64_t)alternative.start + alternative.length > successors.size() ||
+				(uint64_t)alternative.conditionStart + alternative.conditionLength > bytecode.size() ||
+				(uint64_t)alternative.argumentStart + alternative.argumentLength > bytecode.size()) {
+				return false;
+			}
+			//conditions emit nothing, arguments exactly what the successor's modules take
+			uint64_t successorParameters = 0;
+			for (unsigned int m = 0; m < alternative.length; ++m) {
+				successorParameters += arity[(unsigned char)successors[alternative.start + m]];
+			}
+			unsigned int conditionEmitted;
+			if (!CheckBytecode(bytecode.data() + alternative.conditionStart, alternative.conditionLength, conditionEmitted) || conditionEmitted != 0 ||
+				!CheckBytecode(bytecode.data() + alternative.argumentStart, alternative.argumentLength, emitted) ||
+				emitted != alternative.parameterCount || successorParameters != alternative.parameterCount) {
+				return false;
+			}
+			//GatherActuals copies the formals of the module and its context into one set of registers
+			const bool context = alternative.leftContext != 0 || alternative.rightContext != 0;
+			const unsigned int leftArity = alternative.leftContext != 0 ? arity[(unsigned char)alternative.leftContext] : 0;
+			const unsigned int rightArity = alternative.rightContext != 0 ? arity[(unsigned char)alternative.rightContext] : 0;
+			if (context && leftArity + arity[c] + rightArity > LMaxRegisters) {
+				return false;
+			}
+			contextSensitive |= context;
+			conditional[c] |= context || alternative.conditionLength != 0;
+		}
+	}
+	CompileScan();
+	return true;
+}
+
+// Splits a predecessor like "F(l,w)" into its glyph and formal parameter names
+static bool ParseFormals(const std::string& text, char& glyph, std::vector<std::string>& formals)
+{
+	size_t i = text.find_first_not_of(" \t");
+	if (i == std::string::npos) {
+		return false;
+	}
+	glyph = text[i++];
+	i = text.find_first_not_of(" \t", i);
+	if (i == std::string::npos) {
+		return true;
+	}
+	if (text[i] != '(') {
+		return false;
+	}
+	std::string name;
+	for (++i; i < text.size(); ++i) {
+		if (text[i] == ',' || text[i] == ')') {
+			if (name.empty()) {
+				return false;
+			}
+			formals.push_back(name);
+			name.clear();
+			if (text[i] == ')') {
+				return text.find_first_not_of(" \t", i + 1) == std::string::npos;
+			}
+		}
+		else if (!isspace((unsigned char)text[i])) {
+			name += text[i];
+		}
+	}
+	return false;
+}
+
+static bool DeclareArity(int* declaredArity, char glyph, unsigned int count, std::string& error)
+{
+	int& declared = declaredArity[(unsigned char)glyph];
+	if (declared >= 0 && declared != (int)count) {
+		error = std::string("'") + glyph + "' used with " + std::to_string(count) + " parameters but also " + std::to_string(declared);
+		return false;
+	}
+	declared = (int)count;
+	return true;
+}
+
+// Parses a string of modules like "F(l*2)[+(a)X]" into its glyphs, appending bytecode that emits its parameters
+bool LSpecies::CompileModules(const std::string& text, const std::vector<std::string>& formals, int* declaredArity, std::string& glyphs, unsigned int& parameterCount, std::string& error)
+{
+	LExpressionCompiler compiler(formals, bytecode);
+	const char* cursor = text.data();
+	const char* end = cursor + text.size();
+	while (cursor != end) {
+		const char glyph = *cursor++;
+		if (isspace((unsigned char)glyph)) {
+			continue;
+		}
+		unsigned int count = 0;
+		if (cursor != end && *cursor == '(') {
+			++cursor;
+			while (true) {
+				uint8_t result;
+				if (!compiler.Compile(cursor, end, result)) {
+					error = compiler.GetError();
+					return false;
+				}
+				bytecode.push_back({ LOpcode::Emit, 0, result, 0, 0.f });
+				++count;
+				if (cursor != end && *cursor == ',') {
+					++cursor;
+				}
+				else if (cursor != end && *cursor == ')') {
+					++cursor;
+					break;
+				}
+				else {
+					error = "expected ',' or ')'";
+					return false;
+				}
+			}
+		}
+		if (!DeclareArity(declaredArity, glyph, count, error)) {
+			return false;
+		}
+		glyphs += glyph;
+		parameterCount += count;
+	}
+	return true;
+}
+
+void LSpecies::CompileProductions(const std::vector<LProduction>& productions, const std::string& axiomText) {
+	int declaredArity[256];
+	for (int c = 0; c < 256; ++c) {
+		declaredArity[c] = -1;
+	}
+	//compile every production first, since the identity rewrites depend on the arities they declare
+	struct Compiled {
+		char glyph;
+		Alternative alternative;
+	};
+	std::vector<Compiled> compiled;
+	std::string compiledSuccessors;
+	bytecode.clear();
+	for (const LProduction& production : productions) {
+		Compiled entry = {};
+		std::vector<std::string> formals;
+		std::string glyphs;
+		std::string error;
+		//the formals are laid out left context first, then the predecessor, then the right context,
+		//matching the order GatherActuals loads them into registers
+		bool ok = true;
+		const std::string* modules[3] = { &production.leftContext, &production.predecessor, &production.rightContext };
+		char* glyphSlots[3] = { &entry.alternative.leftContext, &entry.glyph, &entry.alternative.rightContext };
+		for (int m = 0; m < 3 && ok; ++m) {
+			if (m != 1 && modules[m]->find_first_not_of(" \t") == std::string::npos) {
+				continue;
+			}
+			const size_t firstFormal = formals.size();
+			ok = ParseFormals(*modules[m], *glyphSlots[m], formals);
+			if (!ok) {
+				error = m == 1 ? "malformed predecessor" : "malformed context";
+			}
+			else {
+				ok = DeclareArity(declaredArity, *glyphSlots[m], (unsigned int)(formals.size() - firstFormal), error);
+			}
+		}
+		if (ok && formals.size() >= LMaxRegisters / 2) {
+			ok = false;
+			error = "too many formal parameters";
+		}
+		if (ok && production.condition.find_first_not_of(" \t") != std::string::npos) {
+			LExpressionCompiler compiler(formals, bytecode);
+			entry.alternative.conditionStart = (unsigned int)bytecode.size();
+			const char* cursor = production.condition.data();
+			const char* end = cursor + production.condition.size();
+			uint8_t result;
+			ok = compiler.Compile(cursor, end, result);
+			if (!ok) {
+				error = compiler.GetError();
+			}
+			else if (cursor != end) {
+				ok = false;
+				error = "unexpected text after condition";
+			}
+			else {
+				bytecode.push_back({ LOpcode::Test, 0, result, 0, 0.f });
+				entry.alternative.conditionLength = (unsigned int)bytecode.size() - entry.alternative.conditionStart;
+			}
+		}
+		if (ok) {
+			entry.alternative.argumentStart = (unsigned int)bytecode.size();
+			ok = CompileModules(production.successor, formals, declaredArity, glyphs, entry.alternative.parameterCount, error);
+			entry.alternative.argumentLength = (unsigned int)bytecode.size() - entry.alternative.argumentStart;
+		}
+		if (!ok) {
+			printf("LSpecies: skipping production '%s' -> '%s': %s\n", production.predecessor.c_str(), production.successor.c_str(), error.c_str());
+			continue;
+		}
+		entry.alternative.start = 256 + (unsigned int)compiledSuccessors.size();
+		entry.alternative.length = (unsigned int)glyphs.size();
+		entry.alternative.weight = production.weight;
+		compiledSuccessors += glyphs;
+		compiled.push_back(entry);
+	}
+	//the axiom is a module string with constant parameters, evaluated once here
+	{
+		std::vector<std::string> noFormals;
+		std::string error;
+		unsigned int parameterCount = 0;
+		const unsigned int axiomCode = (unsigned int)bytecode.size();
+		axiom.symbols.clear();
+		if (!CompileModules(axiomText, noFormals, declaredArity, axiom.symbols, parameterCount, error)) {
+			printf("LSpecies: malformed axiom '%s': %s\n", axiomText.c_str(), error.c_str());
+			axiom.symbols.clear();
+			parameterCount = 0;
+			bytecode.resize(axiomCode);
+		}
+		axiom.parameters.resize(parameterCount);
+		float* out = axiom.parameters.data();
+		RunLBytecode(bytecode.data() + axiomCode, (unsigned int)bytecode.size() - axiomCode, nullptr, 0, out);
+		bytecode.resize(axiomCode);
+	}
+
+	parametric = false;
+	contextSensitive = false;
+	for (const Compiled& entry : compiled) {
+		contextSensitive |= entry.alternative.leftContext != 0 || entry.alternative.rightContext != 0;
+	}
+	for (int c = 0; c < 256; ++c) {
+		arity[c] = (uint8_t)(declaredArity[c] < 0 ? 0 : declaredArity[c]);
+		parametric |= arity[c] != 0;
+	}
+	//the identity rewrite of each symbol just re-emits its own parameters
+	successors.assign(256, '\0');
+	alternatives.clear();
+	for (unsigned int c = 0; c < 256; ++c) {
+		successors[c] = (char)c;
+		Alternative identity = {};
+		identity.start = c;
+		identity.length = 1;
+		identity.threshold = UINT32_MAX;
+		identity.weight = 1.f;
+		identity.argumentStart = (unsigned int)bytecode.size();
+		for (uint8_t i = 0; i < arity[c]; ++i) {
+			bytecode.push_back({ LOpcode::Emit, 0, i, 0, 0.f });
+		}
+		identity.argumentLength = arity[c];
+		identity.parameterCount = arity[c];
+		alternatives.push_back(identity);
+	}
+	successors += compiledSuccessors;
+	for (unsigned int c = 0; c < 256; ++c) {
+		conditional[c] = false;
+		float totalWeight = 0;
+		for (const Compiled& entry : compiled) {
+			if ((unsigned char)entry.glyph == c) {
+				totalWeight += entry.alternative.weight;
+				conditional[c] |= entry.alternative.conditionLength != 0 || entry.alternative.leftContext != 0 || entry.alternative.rightContext != 0;
+			}
+		}
+		if (totalWeight <= 0) {
+			alternativeStart[c] = c;
+			alternativeCount[c] = 1;
+			continue;
+		}
+		//alternatives are stored with cumulative thresholds in [0, 2^32) so selection is an integer compare
+		alternativeStart[c] = (unsigned int)alternatives.size();
+		float cumulativeWeight = 0;
+		for (const Compiled& entry : compiled) {
+			if ((unsigned char)entry.glyph != c) {
+				continue;
+			}
+			cumulativeWeight += entry.alternative.weight;
+			Alternative alternative = entry.alternative;
+			alternative.threshold = LThreshold(cumulativeWeight, totalWeight, false);
+			alternatives.push_back(alternative);
+		}
+		alternatives.back().threshold = LThreshold(cumulativeWeight, totalWeight, true);
+		alternativeCount[c] = (unsigned int)alternatives.size() - alternativeStart[c];
+	}
+	CompileScan();
+}
+
+void LSpecies::CompileScan() {
+	rewrittenGlyphs = LGlyphSet();
+	scanRewrites = !parametric;
+	deterministic = true;
+	for (unsigned int c = 0; c < 256 && scanRewrites; ++c) {
+		if (alternativeStart[c] != c) {
+			scanRewrites = rewrittenGlyphs.Add((char)c);
+			deterministic &= alternativeCount[c] == 1 && !conditional[c];
+		}
+	}
+	deterministic &= scanRewrites;
+}
+
+const float* LSpecies::GatherActuals(const Alternative& alternative, char symbol, const float* own, const LString* input, const LBracketIndex* index, size_t position, float* scratch, unsigned int& count) const {
+	count = arity[(unsigned char)symbol];
+	if (alternative.leftContext == 0 && alternative.rightContext == 0) {
+		return own;
+	}
+	//context formals come from other modules, so everything is copied together in formal order
+	const float* parameters = input->parameters.data();
+	float* out = scratch;
+	if (alternative.leftContext != 0) {
+		const uint32_t neighbor = index->left[position];
+		const uint8_t neighborArity = arity[(unsigned char)alternative.leftContext];
+		memcpy(out, parameters + index->parameterOffset[neighbor], neighborArity * sizeof(float));
+		out += neighborArity;
+	}
+	if (count > 0) {
+		memcpy(out, own, count * sizeof(float));
+		out += count;
+	}
+	if (alternative.rightContext != 0) {
+		const uint32_t neighbor = index->right[position];
+		const uint8_t neighborArity = arity[(unsigned char)alternative.rightContext];
+		memcpy(out, parameters + index->parameterOffset[neighbor], neighborArity * sizeof(float));
+		out += neighborArity;
+	}
+	count = (unsigned int)(out - scratch);
+	return scratch;
+}
+
+bool LSpecies::Applies(const Alternative& alternative, char symbol, const float* own, const LString* input, const LBracketIndex* index, size_t position) const {
+	if (alternative.leftContext != 0) {
+		const uint32_t neighbor = index->left[position];
+		if (neighbor == LBracketIndex::None || input->symbols[neighbor] != alternative.leftContext) {
+			return false;
+		}
+	}
+	if (alternative.rightContext != 0) {
+		const uint32_t neighbor = index->right[position];
+		if (neighbor == LBracketIndex::None || input->symbols[neighbor] != alternative.rightContext) {
+			return false;
+		}
+	}
+	if (alternative.conditionLength == 0) {
+		return true;
+	}
+	float scratch[LMaxRegisters];
+	unsigned int count;
+	const float* actuals = GatherActuals(alternative, symbol, own, input, index, position, scratch, count);
+	float* unused = nullptr;
+	return RunLBytecode(bytecode.data() + alternative.conditionStart, alternative.conditionLength, actuals, count, unused);
+}
+
+const LSpecies::Alternative& LSpecies::SelectAlternative(char symbol, const float* own, const LString* input, const LBracketIndex* index, uint64_t position, uint32_t seed, uint32_t iteration) const {
+	const unsigned char c = (unsigned char)symbol;
+	const Alternative* candidates = &alternatives[alternativeStart[c]];
+	const unsigned int count = alternativeCount[c];
+	if (!conditional[c]) {
+		if (count == 1) {
+			return *candidates;
+		}
+		const uint32_t roll = LHash(seed, iteration, position);
+		unsigned int k = 0;
+		while (roll >= candidates[k].threshold && k + 1 < count) {
+			++k;
+		}
+		return candidates[k];
+	}
+	//only the alternatives whose context and condition hold take part in the draw; if none do, the module is kept as is
+	float eligibleWeight = 0;
+	for (unsigned int k = 0; k < count; ++k) {
+		if (Applies(candidates[k], symbol, own, input, index, (size_t)position)) {
+			eligibleWeight += candidates[k].weight;
+		}
+	}
+	if (eligibleWeight <= 0) {
+		return alternatives[c];
+	}
+	float roll = (LHash(seed, iteration, position) >> 8) * (1.f / 16777216.f) * eligibleWeight;
+	const Alternative* chosen = nullptr;
+	for (unsigned int k = 0; k < count; ++k) {
+		if (Applies(candidates[k], symbol, own, input, index, (size_t)position)) {
+			chosen = &candidates[k];
+			roll -= candidates[k].weight;
+			if (roll < 0) {
+				break;
+			}
+		}
+	}
+	return *chosen;
+}
+
+bool LSpecies::IsIdentity(const Alternative& alternative) const {
+	return &alternative < alternatives.data() + 256;
+}
+
+static uint64_t SaturatingAdd(uint64_t a, uint64_t b)
+{
+	return a > UINT64_MAX - b ? UINT64_MAX : a + b;
+}
+
+static uint64_t SaturatingMultiply(uint64_t a, uint64_t b)
+{
+	return b != 0 && a > UINT64_MAX / b ? UINT64_MAX : a * b;
+}
+
+void LSpecies::CompileGrowth() {
+	//only glyphs the axiom or a successor can produce ever need counting
+	int glyphIndex[256];
+	for (int c = 0; c < 256; ++c) {
+		glyphIndex[c] = -1;
+	}
+	growthGlyphs.clear();
+	auto use = [&](const char* glyphs, size_t length) {
+		for (size_t k = 0; k < length; ++k) {
+			const unsigned char c = (unsigned char)glyphs[k];
+			if (glyphIndex[c] < 0) {
+				glyphIndex[c] = (int)growthGlyphs.size();
+				growthGlyphs.push_back(c);
+			}
+		}
+	};
+	use(axiom.symbols.data(), axiom.symbols.size());
+	use(successors.data() + 256, successors.size() - 256);
+	const size_t n = growthGlyphs.size();
+	//each row holds, for one glyph, the most of every glyph any of its alternatives produces
+	growthMatrix.assign(n * n, 0);
+	growthExact = true;
+	for (size_t i = 0; i < n; ++i) {
+		const unsigned char c = growthGlyphs[i];
+		uint32_t* row = &growthMatrix[i * n];
+		if (alternativeStart[c] == c || conditional[c]) {
+			//kept as is, at least whenever no condition holds
+			row[i] = 1;
+		}
+		growthExact &= alternativeCount[c] == 1 && !conditional[c];
+		if (alternativeStart[c] == c) {
+			continue;
+		}
+		for (unsigned int k = 0; k < alternativeCount[c]; ++k) {
+			const Alternative& alternative = alternatives[alternativeStart[c] + k];
+			std::vector<uint32_t> counts(n, 0);
+			for (unsigned int m = 0; m < alternative.length; ++m) {
+				++counts[glyphIndex[(unsigned char)successors[alternative.start + m]]];
+			}
+			for (size_t j = 0; j < n; ++j) {
+				row[j] = counts[j] > row[j] ? counts[j] : row[j];
+			}
+		}
+	}
+}
+
+void LSpecies::StartGrowth(std::vector<uint64_t>& counts) const {
+	counts.assign(growthGlyphs.size(), 0);
+	for (char c : axiom.symbols) {
+		for (size_t i = 0; i < growthGlyphs.size(); ++i) {
+			counts[i] += growthGlyphs[i] == (unsigned char)c;
+		}
+	}
+}
+
+bool LSpecies::StepGrowth(std::vector<uint64_t>& counts, std::vector<uint64_t>& next) const {
+	const size_t n = growthGlyphs.size();
+	std::fill(next.begin(), next.end(), 0);
+	for (size_t i = 0; i < n; ++i) {
+		if (counts[i] == 0) {
+			continue;
+		}
+		const uint32_t* row = &growthMatrix[i * n];
+		for (size_t j = 0; j < n; ++j) {
+			next[j] = SaturatingAdd(next[j], SaturatingMultiply(counts[i], row[j]));
+		}
+	}
+	//once an iteration changes nothing, saturated counts included, no later one will either
+	const bool settled = next == counts;
+	counts.swap(next);
+	return !settled;
+}
+
+LSpecies::GrowthStep LSpecies::CountGrowth(const std::vector<uint64_t>& counts) const {
+	GrowthStep step = { 0, 0 };
+	for (size_t i = 0; i < counts.size(); ++i) {
+		step.modules = SaturatingAdd(step.modules, counts[i]);
+		step.parameters = SaturatingAdd(step.parameters, SaturatingMultiply(counts[i], arity[growthGlyphs[i]]));
+	}
+	return step;
+}
+
+static uint64_t GrowthBytes(uint64_t modules, uint64_t parameters)
+{
+	return SaturatingAdd(modules, SaturatingMultiply(parameters, sizeof(float)));
+}
+
+LSpecies::GrowthStep LSpecies::PredictGrowth(int iterations, GrowthStep* largest, std::vector<uint64_t>* glyphCounts) const {
+	std::vector<uint64_t> counts;
+	std::vector<uint64_t> next(growthGlyphs.size());
+	StartGrowth(counts);
+	iterations = iterations < 0 ? 0 : iterations > MaxIterations ? MaxIterations : iterations;
+	GrowthStep step = CountGrowth(counts);
+	GrowthStep most = step;
+	for (int i = 0; i < iterations && StepGrowth(counts, next); ++i) {
+		step = CountGrowth(counts);
+		most.modules = step.modules > most.modules ? step.modules : most.modules;
+		most.parameters = step.parameters > most.parameters ? step.parameters : most.parameters;
+	}
+	if (largest != nullptr) {
+		*largest = most;
+	}
+	if (glyphCounts != nullptr) {
+		glyphCounts->swap(counts);
+	}
+	return step;
+}
+
+uint64_t LSpecies::PredictSize(int iterations) const {
+	return PredictGrowth(iterations).modules;
+}
+
+uint64_t LSpecies::PredictBytes(int iterations) const {
+	const GrowthStep step = PredictGrowth(iterations);
+	return GrowthBytes(step.modules, step.parameters);
+}
+
+bool LSpecies::IsSizeExact() const {
+	return growthExact;
+}
+
+void LSpecies::SetGrowBudget(uint64_t bytes) {
+	growBudget = bytes;
+}
+
+int LSpecies::ClampIterations(int iterations) {
+	if (iterations < 0) {
+		return 0;
+	}
+	if (iterations > MaxIterations) {
+		printf("LSpecies: %d iterations is more than the %d allowed; stopping at %d\n", iterations, MaxIterations, MaxIterations);
+		return MaxIterations;
+	}
+	return iterations;
+}
+
+int LSpecies::CapIterations(int iterations, bool cached) const {
+	iterations = ClampIterations(iterations);
+	//context-sensitive species index every string they rewrite, and an index has room for fewer than
+	//LBracketIndex::None modules and parameters
+	if (growBudget == 0 && !contextSensitive) {
+		return iterations;
+	}
+	//one iteration at a time, so a huge count costs no more than the iterations that fit
+	std::vector<uint64_t> counts;
+	std::vector<uint64_t> next(growthGlyphs.size());
+	StartGrowth(counts);
+	GrowthStep step = CountGrowth(counts);
+	uint64_t bytes = GrowthBytes(step.modules, step.parameters);
+	uint64_t total = bytes;
+	uint64_t most = bytes;
+	bool changing = true;
+	for (int i = 1; i <= iterations; ++i) {
+		//once nothing changes the buffers stop growing, but the cache still keeps a copy per iteration
+		changing = changing && StepGrowth(counts, next);
+		if (!changing && !cached) {
+			break;
+		}
+		if (changing) {
+			step = CountGrowth(counts);
+			bytes = GrowthBytes(step.modules, step.parameters);
+		}
+		total = SaturatingAdd(total, bytes);
+		most = bytes > most ? bytes : most;
+		//the cache keeps every iteration up to this one; growing into buffers keeps two, each as big as
+		//the largest iteration so far at most
+		const uint64_t held = cached ? total : SaturatingMultiply(most, 2);
+		if (growBudget != 0 && held > growBudget) {
+			printf("LSpecies: growing iteration %d could hold %llu bytes at once, over the budget of %llu; stopping at %d of %d\n",
+				i, (unsigned long long)held, (unsigned long long)growBudget, i - 1, iterations);
+			return i - 1;
+		}
+		//this iteration is only indexed if another is grown from it
+		if (contextSensitive && i < iterations && !LBracketIndex::Fits(step.modules, step.parameters)) {
+			printf("LSpecies: iteration %d could have %llu modules and %llu parameters, too many to find context in; stopping at %d of %d\n",
+				i, (unsigned long long)step.modules, (unsigned long long)step.parameters, i, iterations);
+			return i;
+		}
+	}
+	return iterations;
+}
+
+const LString& LSpecies::Grow(int iterations, uint32_t seed) {
+	return GrowCapped(CapIterations(iterations, true), seed);
+}
+
+const LString& LSpecies::GrowCapped(int iterations, uint32_t seed) {
+	if (seed != growCacheSeed) {
+		growCache.clear();
+		growCacheSeed = seed;
+	}
+	if (growCache.empty()) {
+		growCache[0] = axiom;
+	}
+	auto grown = std::prev(growCache.upper_bound(iterations));
+	if (grown->first == iterations) {
+		return grown->second;
+	}
+	if (!growCacheDirectory.empty()) {
+		//a later iteration from disk beats anything in memory
+		for (int i = iterations; i > grown->first; --i) {
+			LString loaded;
+			if (LoadGrown(GrowCachePath(i, seed), loaded)) {
+				grown = growCache.emplace(i, std::move(loaded)).first;
+				break;
+			}
+		}
+		if (grown->first == iterations) {
+			return grown->second;
+		}
+	}
+	for (int i = grown->first; i < iterations; ++i) {
+		auto next = growCache.emplace(i + 1, LString()).first;
+		Rewrite(grown->second, seed, i, next->second);
+		grown = next;
+	}
+	if (!growCacheDirectory.empty()) {
+		SaveGrown(GrowCachePath(iterations, seed), grown->second);
+	}
+	return grown->second;
+}
+
+bool LSpecies::IsGrown(int iterations, uint32_t seed) const {
+	return seed == growCacheSeed && growCache.count(iterations) != 0;
+}
+
+void LSpecies::SetGrowCacheDirectory(const std::string& directory) {
+	growCacheDirectory = directory;
+}
+
+void LSpecies::ClearGrowCache() {
+	growCache.clear();
+}
+
+std::string LSpecies::GrowCachePath(int iterations, uint32_t seed) const {
+	char name[64];
+	snprintf(name, sizeof(name), "/%016llx-%u-%d.lstring", (unsigned long long)sourceHash, seed, iterations);
+	return growCacheDirectory + name;
+}
+
+// Layout of a cached grown string: this header, then the symbols, then the parameters
+struct LGrownHeader {
+	char magic[4];
+	uint32_t version;   // bumped whenever the same species and seed would grow differently
+	uint64_t symbolCount;
+	uint64_t parameterCount;
+};
+static const char lGrownMagic[4] = { 'L', 'S', 'T', 'R' };
+static const uint32_t lGrownVersion = 1;
+
+bool LSpecies::LoadGrown(const std::string& path, LString& grown) const {
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+	LGrownHeader header;
+	if (!file.read((char*)&header, sizeof(header)) || memcmp(header.magic, lGrownMagic, sizeof(lGrownMagic)) != 0 || header.version != lGrownVersion) {
+		printf("LSpecies: ignoring unreadable grow cache '%s'\n", path.c_str());
+		return false;
+	}
+	//the counts have to fill the rest of the file exactly before anything is allocated for them
+	const std::streamoff start = file.tellg();
+	file.seekg(0, std::ios::end);
+	const uint64_t remaining = (uint64_t)(file.tellg() - start);
+	file.seekg(start);
+	if (header.symbolCount > remaining || header.parameterCount > (remaining - header.symbolCount) / sizeof(float) ||
+		header.symbolCount + header.parameterCount * sizeof(float) != remaining) {
+		printf("LSpecies: ignoring truncated grow cache '%s'\n", path.c_str());
+		return false;
+	}
+	grown.symbols.resize((size_t)header.symbolCount);
+	grown.parameters.resize((size_t)header.parameterCount);
+	if (!file.read(&grown.symbols[0], grown.symbols.size()) || !file.read((char*)grown.parameters.data(), grown.parameters.size() * sizeof(float))) {
+		printf("LSpecies: ignoring truncated grow cache '%s'\n", path.c_str());
+		return false;
+	}
+	//a string grown by some other version of the productions would have Build read past its parameters
+	uint64_t parameters = 0;
+	for (char glyph : grown.symbols) {
+		parameters += arity[(unsigned char)glyph];
+	}
+	if (parameters != grown.parameters.size()) {
+		printf("LSpecies: ignoring grow cache '%s', which doesn't fit this species\n", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+void LSpecies::SaveGrown(const std::string& path, const LString& grown) const {
+	std::ofstream file(path, std::ios::binary);
+	LGrownHeader header = {};
+	memcpy(header.magic, lGrownMagic, sizeof(lGrownMagic));
+	header.version = lGrownVersion;
+	header.symbolCount = grown.symbols.size();
+	header.parameterCount = grown.parameters.size();
+	file.write((const char*)&header, sizeof(header));
+	file.write(grown.symbols.data(), grown.symbols.size());
+	file.write((const char*)grown.parameters.data(), grown.parameters.size() * sizeof(float));
+	if (!file) {
+		printf("LSpecies: couldn't write grow cache '%s'\n", path.c_str());
+	}
+}
+
+void LSpecies::SetGrowThreads(unsigned int threads, size_t minModulesPerThread) {
+	growThreads = threads < 1 ? 1 : threads;
+	this->minModulesPerThread = minModulesPerThread < 1 ? 1 : minModulesPerThread;
+}
+
+unsigned int LSpecies::GetGrowThreads() const {
+	return growThreads;
+}
+
+size_t LSpecies::GetMinModulesPerThread() const {
+	return minModulesPerThread;
+}
+
+void LSpecies::SetBuildThreads(unsigned int threads, size_t minModulesPerBranch) {
+	buildThreads = threads < 1 ? 1 : threads;
+	this->minModulesPerBranch = minModulesPerBranch < 2 ? 2 : minModulesPerBranch;
+}
+
+void LSpecies::SetBuildStreams(bool keep) {
+	buildStreams = keep;
+}
+
+void LSpecies::ClearBuildArena() {
+	std::lock_guard<std::mutex> lock(buildArenaMutex);
+	buildArena.Clear();
+}
+
+void LSpecies::CountRewrite(const LString& input, const LBracketIndex* index, size_t begin, size_t end, size_t parameterBegin, uint32_t seed, uint32_t iteration, size_t& length, size_t& parameterLength) const {
+	const char* in = input.symbols.data();
+	const float* inParameters = input.parameters.data();
+	size_t parameterCursor = parameterBegin;
+	length = 0;
+	parameterLength = 0;
+	if (deterministic) {
+		//every occurrence of a rewritten glyph grows the string by the same amount
+		length = end - begin;
+		for (unsigned int g = 0; g < rewrittenGlyphs.count; ++g) {
+			const char glyph = rewrittenGlyphs.glyphs[g];
+			const size_t occurrences = LCountOf(in + begin, end - begin, glyph);
+			length = length - occurrences + occurrences * alternatives[alternativeStart[(unsigned char)glyph]].length;
+		}
+		return;
+	}
+	if (scanRewrites) {
+		for (size_t p = begin; ; ++p) {
+			const size_t run = LFindFirstOf(in + p, end - p, rewrittenGlyphs);
+			length += run;
+			p += run;
+			if (p == end) {
+				return;
+			}
+			length += SelectAlternative(in[p], nullptr, &input, index, p, seed, iteration).length;
+		}
+	}
+	for (size_t p = begin; p < end; ++p) {
+		const Alternative& alternative = SelectAlternative(in[p], inParameters + parameterCursor, &input, index, p, seed, iteration);
+		length += alternative.length;
+		parameterLength += alternative.parameterCount;
+		parameterCursor += arity[(unsigned char)in[p]];
+	}
+}
+
+void LSpecies::WriteRewrite(const LString& input, const LBracketIndex* index, size_t begin, size_t end, size_t parameterBegin, uint32_t seed, uint32_t iteration, char* out, float* outParameters) const {
+	const char* table = successors.data();
+	const LInstruction* code = bytecode.data();
+	const char* in = input.symbols.data();
+	const float* inParameters = input.parameters.data();
+	size_t parameterCursor = parameterBegin;
+	float actualScratch[LMaxRegisters];
+	if (scanRewrites) {
+		//copy runs of unrewritten glyphs straight through
+		for (size_t p = begin; ; ++p) {
+			const size_t run = LFindFirstOf(in + p, end - p, rewrittenGlyphs);
+			memcpy(out, in + p, run);
+			out += run;
+			p += run;
+			if (p == end) {
+				return;
+			}
+			const Alternative& alternative = SelectAlternative(in[p], nullptr, &input, index, p, seed, iteration);
+			memcpy(out, table + alternative.start, alternative.length);
+			out += alternative.length;
+		}
+	}
+	for (size_t p = begin; p < end; ++p) {
+		const Alternative& alternative = SelectAlternative(in[p], inParameters + parameterCursor, &input, index, p, seed, iteration);
+		if (alternative.length == 1) {
+			*out++ = table[alternative.start];
+		}
+		else {
+			memcpy(out, table + alternative.start, alternative.length);
+			out += alternative.length;
+		}
+		if (parametric) {
+			unsigned int actualCount;
+			const float* actuals = GatherActuals(alternative, in[p], inParameters + parameterCursor, &input, index, p, actualScratch, actualCount);
+			RunLBytecode(code + alternative.argumentStart, alternative.argumentLength, actuals, actualCount, outParameters);
+			parameterCursor += arity[(unsigned char)in[p]];
+		}
+	}
+}
+
+bool LSpecies::Grow(int iterations, uint32_t seed, LDerivation& result) const {
+	return result.Derive(*this, ClampIterations(iterations), seed);
+}
+
+void LSpecies::Grow(int iterations, uint32_t seed, LString& result, LString& scratch) const {
+	GrowCapped(CapIterations(iterations, false), seed, result, scratch);
+}
+
+void LSpecies::GrowCapped(int iterations, uint32_t seed, LString& result, LString& scratch) const {
+	if (growthExact) {
+		//sizes are known exactly, so both buffers can be allocated once for the largest iteration
+		GrowthStep largest;
+		PredictGrowth(iterations, &largest);
+		result.symbols.reserve((size_t)largest.modules);
+		result.parameters.reserve((size_t)largest.parameters);
+		scratch.symbols.reserve((size_t)largest.modules);
+		scratch.parameters.reserve((size_t)largest.parameters);
+	}
+	result = axiom;
+	for (int i = 0; i < iterations; ++i) {
+		Rewrite(result, seed, i, scratch);
+		result.swap(scratch);
+	}
+}
+
+void LSpecies::Rewrite(const LString& input, uint32_t seed, uint32_t iteration, LString& output) const {
+	LBracketIndex bracketIndex;
+	const LBracketIndex* index = nullptr;
+	if (contextSensitive) {
+		bracketIndex.Build(input, arity);
+		index = &bracketIndex;
+	}
+	//size the output exactly before writing so each iteration is a single linear pass.
+	//alternatives are a pure function of (seed, iteration, position, parameters), so both passes agree
+	const size_t inputLength = input.symbols.size();
+	const size_t chunksAvailable = inputLength / minModulesPerThread;
+	const unsigned int numChunks = chunksAvailable < growThreads ? (unsigned int)chunksAvailable : growThreads;
+	if (numChunks <= 1) {
+		size_t length;
+		size_t parameterLength;
+		CountRewrite(input, index, 0, inputLength, 0, seed, iteration, length, parameterLength);
+		output.symbols.resize(length);
+		output.parameters.resize(parameterLength);
+		WriteRewrite(input, index, 0, inputLength, 0, seed, iteration, &output.symbols[0], output.parameters.data());
+		return;
+	}
+	//per-chunk input parameter offsets and output sizes
+	struct Chunk {
+		size_t begin;
+		size_t end;
+		size_t parameterBegin;
+		size_t length;
+		size_t parameterLength;
+		size_t outBegin;
+		size_t outParameterBegin;
+	};
+	//count each chunk's output in parallel, prefix-sum the counts into output offsets, then
+	//let every chunk scatter its rewrite straight into place
+	std::vector<Chunk> chunks(numChunks);
+	for (unsigned int k = 0; k < numChunks; ++k) {
+		chunks[k].begin = inputLength * k / numChunks;
+		chunks[k].end = inputLength * (k + 1) / numChunks;
+	}
+	if (parametric) {
+		ParallelFor(numChunks, growThreads, [&](unsigned int k) {
+			size_t parameters = 0;
+			for (size_t p = chunks[k].begin; p < chunks[k].end; ++p) {
+				parameters += arity[(unsigned char)input.symbols[p]];
+			}
+			chunks[k].parameterBegin = parameters;
+		});
+		size_t parameterOffset = 0;
+		for (Chunk& chunk : chunks) {
+			const size_t parameters = chunk.parameterBegin;
+			chunk.parameterBegin = parameterOffset;
+			parameterOffset += parameters;
+		}
+	}
+	else {
+		for (Chunk& chunk : chunks) {
+			chunk.parameterBegin = 0;
+		}
+	}
+	ParallelFor(numChunks, growThreads, [&](unsigned int k) {
+		CountRewrite(input, index, chunks[k].begin, chunks[k].end, chunks[k].parameterBegin, seed, iteration, chunks[k].length, chunks[k].parameterLength);
+	});
+	size_t length = 0;
+	size_t parameterLength = 0;
+	for (Chunk& chunk : chunks) {
+		chunk.outBegin = length;
+		chunk.outParameterBegin = parameterLength;
+		length += chunk.length;
+		parameterLength += chunk.parameterLength;
+	}
+	output.symbols.resize(length);
+	output.parameters.resize(parameterLength);
+	ParallelFor(numChunks, growThreads, [&](unsigned int k) {
+		WriteRewrite(input, index, chunks[k].begin, chunks[k].end, chunks[k].parameterBegin, seed, iteration,
+			&output.symbols[0] + chunks[k].outBegin, output.parameters.data() + chunks[k].outParameterBegin);
+	});
+}
+
+// Feeds the modules of a grown string to Interpret, skipping runs the turtle ignores in bulk.
+// Given a bracket index, branches nested deeper than maxDepth are jumped over whole.
+class LStringReader
+{
+private:
+	const char* begin;
+	const char* cursor;
+	const char* end;
+	const float* parameterBase;
+	const float* parameters;
+	const uint8_t* arity;
+	bool parametric;
+	const LBracketIndex* brackets;
+	uint32_t maxDepth;
+
+public:
+	LStringReader(const LString& string, const uint8_t* arity, bool parametric, const LBracketIndex* brackets = nullptr, uint32_t maxDepth = UINT32_MAX) :
+		begin(string.symbols.data()), cursor(begin), end(begin + string.symbols.size()),
+		parameterBase(string.parameters.data()), parameters(parameterBase), arity(arity), parametric(parametric),
+		brackets(brackets), maxDepth(maxDepth) {};
+
+	// Reads just the modules in [first, last), the first of whose parameters is at parameterFirst
+	void Limit(size_t first, size_t last, size_t parameterFirst) {
+		cursor = begin + first;
+		end = begin + last;
+		parameters = parameterBase + parameterFirst;
+	}
+
+	bool Next(char& glyph, const float*& arguments, unsigned int& argumentCount) {
+		while (true) {
+			const char* skipped = cursor;
+			cursor = SkipInertSymbols(cursor, end);
+			if (parametric) {
+				for (; skipped != cursor; ++skipped) {
+					parameters += arity[(unsigned char)*skipped];
+				}
+			}
+			if (cursor == end) {
+				return false;
+			}
+			const uint32_t position = (uint32_t)(cursor - begin);
+			if (brackets != nullptr && *cursor == '[' && brackets->depth[position] >= maxDepth) {
+				const uint32_t resume = brackets->SkipBranch(position);
+				cursor = begin + resume;
+				if (parametric) {
+					parameters = parameterBase + brackets->parameterOffset[resume - 1] + arity[(unsigned char)begin[resume - 1]];
+				}
+				continue;
+			}
+			glyph = *cursor++;
+			arguments = parameters;
+			argumentCount = arity[(unsigned char)glyph];
+			parameters += argumentCount;
+			return true;
+		}
+	}
+};
+
+// What the Mesh*-returning Builds draw
+static const std::vector<LSpecies::Detail> defaultDetails = { { 8, 0 } };
+
+Mesh* LSpecies::Build(const LString& rule, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context)
+{
+	return Build(rule, defaultDetails, device, context)[0];
 }
-std::string LSpecies::Grow(int iterations) {
-	std::string rule = axiom;
-	for (int i = 0; i < iterations; ++i) {
-		rule = iterator(rule);
+
+std::vector<Mesh*> LSpecies::Build(const LString& rule, const std::vector<Detail>& details, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, Foliage* foliage, LBranchBounds* bounds, LBuildArena* arena)
+{
+	TurtleCounts counts;
+	CountTurtle(rule.symbols.data(), rule.symbols.size(), counts);
+	//splitting the string up needs its bracket index, so one too long to index is traced whole
+	if (buildThreads > 1 && rule.symbols.size() >= 2 * minModulesPerBranch && LBracketIndex::Fits(rule)) {
+		Turtle turtle(InitialState(), details, false, foliage != nullptr, bounds != nullptr);
+		ArenaLease lease(*this, arena);
+		LBuildArena& buffers = lease.Arena();
+		turtle.Borrow(buffers.At(0));
+		turtle.Reserve(counts);
+		TraceParallel(rule, turtle, buffers);
+		CreateRecorded(turtle, foliage, bounds, device);
+		const std::vector<Mesh*> meshes = CreateMeshes(turtle, details.size(), device, context);
+		turtle.Return(buffers.At(0));
+		return meshes;
+	}
+	LStringReader reader(rule, arity, parametric);
+	return Interpret(reader, &counts, details, device, context, foliage, bounds, ArenaLease(*this, arena).Arena());
+}
+
+Mesh* LSpecies::Build(const LString& rule, const LBracketIndex& brackets, unsigned int maxBranchDepth, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, LBuildArena* arena)
+{
+	//a string too long to index can't have been given an index of it
+	if (!LBracketIndex::Fits(rule)) {
+		printf("LSpecies: %llu modules and %llu parameters are too many to build by bracket index\n", (unsigned long long)rule.symbols.size(), (unsigned long long)rule.parameters.size());
+		return nullptr;
+	}
+	LStringReader reader(rule, arity, parametric, &brackets, maxBranchDepth);
+	return Interpret(reader, nullptr, defaultDetails, device, context, nullptr, nullptr, ArenaLease(*this, arena).Arena())[0];
+}
+
+Mesh* LSpecies::Build(const LDerivation& derivation, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, LBuildArena* arena)
+{
+	LDerivation::Reader reader(derivation);
+	return Interpret(reader, nullptr, defaultDetails, device, context, nullptr, nullptr, ArenaLease(*this, arena).Arena())[0];
+}
+
+Mesh* LSpecies::Build(int iterations, uint32_t seed, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context)
+{
+	return Build(iterations, seed, defaultDetails, device, context)[0];
+}
+
+std::vector<Mesh*> LSpecies::Build(int iterations, uint32_t seed, const std::vector<Detail>& details, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, Foliage* foliage, LBranchBounds* bounds, LBuildArena* arena)
+{
+	iterations = CapIterations(iterations, !growCacheDirectory.empty());
+	//a string already grown is cheaper to read back than to derive again
+	if (IsGrown(iterations, seed) || !growCacheDirectory.empty()) {
+		return Build(GrowCapped(iterations, seed), details, device, context, foliage, bounds, arena);
+	}
+	if (contextSensitive) {
+		LString grown;
+		LString scratch;
+		GrowCapped(iterations, seed, grown, scratch);
+		return Build(grown, details, device, context, foliage, bounds, arena);
+	}
+	TurtleCounts counts;
+	const bool counted = PredictTurtle(iterations, counts);
+	LExpander expander(*this, iterations, seed);
+	return Interpret(expander, counted ? &counts : nullptr, details, device, context, foliage, bounds, ArenaLease(*this, arena).Arena());
+}
+
+void LSpecies::Compile(const LString& rule, LTurtleProgram& program) const
+{
+	LStringReader reader(rule, arity, parametric);
+	CompileTurtle(reader, program);
+}
+
+void LSpecies::Compile(int iterations, uint32_t seed, LTurtleProgram& program) const
+{
+	iterations = CapIterations(iterations, !growCacheDirectory.empty());
+	if (IsGrown(iterations, seed)) {
+		Compile(growCache.at(iterations), program);
+		return;
+	}
+	if (contextSensitive) {
+		LString grown;
+		LString scratch;
+		GrowCapped(iterations, seed, grown, scratch);
+		Compile(grown, program);
+		return;
+	}
+	LExpander expander(*this, iterations, seed);
+	CompileTurtle(expander, program);
+}
+
+std::vector<Mesh*> LSpecies::Build(const LTurtleProgram& program, const std::vector<Detail>& details, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, Foliage* foliage, LBranchBounds* bounds, LBuildArena* arena)
+{
+	const TurtleCounts counts = { program.segments, program.tips, program.leaves, program.branches, program.depth };
+	return Interpret(program, &counts, details, device, context, foliage, bounds, ArenaLease(*this, arena).Arena());
+}
+
+LSpecies::Turtle::Turtle(const LState& state, const std::vector<Detail>& details, bool instanced, bool recordLeaves, bool recordBounds) :
+	state(state), instanced(instanced), recordLeaves(recordLeaves), recordBounds(recordBounds)
+{
+	if (details.size() > LFooting::MaxDetails) {
+		printf("LSpecies: only the first %u of %u levels of detail are built\n", LFooting::MaxDetails, (unsigned int)details.size());
+	}
+	for (size_t l = 0; l < details.size() && l < LFooting::MaxDetails; ++l) {
+		levels.push_back(Level(LRing(details[l].sides), details[l].minThickness));
+	}
+}
+
+LSpecies::Turtle::Turtle(const LState& state, const Turtle& like) :
+	state(state), instanced(like.instanced), recordLeaves(like.recordLeaves), recordBounds(like.recordBounds)
+{
+	for (const Level& level : like.levels) {
+		levels.push_back(Level(level.ring, level.minThickness));
+	}
+}
+
+void LSpecies::Turtle::Reserve(const TurtleCounts& counts)
+{
+	const size_t drawn = counts.segments + counts.tips;
+	savedStates.reserve(savedStates.size() + counts.depth);
+	savedFootings.reserve(savedFootings.size() + counts.depth);
+	if (instanced) {
+		instances.reserve(instances.size() + drawn);
+	}
+	if (recordLeaves) {
+		leaves.reserve(leaves.size() + counts.leaves);
+	}
+	if (recordBounds) {
+		bounds.segments.reserve(bounds.segments.size() + drawn);
+		bounds.brackets.reserve(bounds.brackets.size() + 2 * counts.branches);
+	}
+	//a segment adds at most two rings and six triangles a side, a tip a ring, its point and a triangle
+	//a side.  Levels that leave thin branches out would leave most of that unused, so they just grow.
+	for (Level& level : levels) {
+		if (level.minThickness > 0) {
+			continue;
+		}
+		const size_t sides = level.ring.Sides();
+		level.vertices.reserve(level.vertices.size() + sides * (2 * counts.segments + counts.tips) + counts.tips);
+		level.indices.reserve(level.indices.size() + sides * (6 * counts.segments + 3 * counts.tips));
+	}
+}
+
+// Swaps a buffer into the turtle with nothing in it, or back out as it is
+template <class Buffer>
+static void SwapIn(Buffer& turtle, Buffer& arena)
+{
+	turtle.swap(arena);
+	turtle.clear();
+}
+
+void LSpecies::Turtle::Borrow(LBuildArena::Buffers& arena)
+{
+	if (arena.vertices.size() < levels.size()) {
+		arena.vertices.resize(levels.size());
+		arena.indices.resize(levels.size());
+	}
+	for (size_t l = 0; l < levels.size(); ++l) {
+		SwapIn(levels[l].vertices, arena.vertices[l]);
+		SwapIn(levels[l].indices, arena.indices[l]);
+	}
+	SwapIn(savedStates, arena.savedStates);
+	SwapIn(savedFootings, arena.savedFootings);
+	SwapIn(instances, arena.instances);
+	SwapIn(leaves, arena.leaves);
+	SwapIn(bounds.segments, arena.bounds.segments);
+	SwapIn(bounds.brackets, arena.bounds.brackets);
+}
+
+void LSpecies::Turtle::Return(LBuildArena::Buffers& arena)
+{
+	for (size_t l = 0; l < levels.size(); ++l) {
+		levels[l].vertices.swap(arena.vertices[l]);
+		levels[l].indices.swap(arena.indices[l]);
+	}
+	savedStates.swap(arena.savedStates);
+	savedFootings.swap(arena.savedFootings);
+	instances.swap(arena.instances);
+	leaves.swap(arena.leaves);
+	bounds.segments.swap(arena.bounds.segments);
+	bounds.brackets.swap(arena.bounds.brackets);
+}
+
+LSpecies::ArenaLease::ArenaLease(LSpecies& species, LBuildArena* given) : arena(given)
+{
+	if (arena != nullptr) {
+		return;
+	}
+	lock = std::unique_lock<std::mutex>(species.buildArenaMutex, std::try_to_lock);
+	if (lock.owns_lock()) {
+		arena = &species.buildArena;
+	}
+	else {
+		local.reset(new LBuildArena());
+		arena = local.get();
+	}
+}
+
+LBuildArena& LSpecies::ArenaLease::Arena()
+{
+	return *arena;
+}
+
+void LSpecies::CountTurtle(const char* symbols, size_t length, TurtleCounts& counts)
+{
+	//the glyphs LSymbol gives those commands
+	counts.segments = LCountOf(symbols, length, 'F');
+	counts.tips = LCountOf(symbols, length, 'X');
+	counts.leaves = LCountOf(symbols, length, 'L');
+	counts.branches = 0;
+	counts.depth = 0;
+	//only brackets change the depth, so the scan jumps from one to the next
+	static const LGlyphSet brackets = [] {
+		LGlyphSet set;
+		set.Add('[');
+		set.Add(']');
+		return set;
+	}();
+	size_t depth = 0;
+	for (size_t p = LFindFirstOf(symbols, length, brackets); p < length; p += 1 + LFindFirstOf(symbols + p + 1, length - p - 1, brackets)) {
+		if (symbols[p] == '[') {
+			++counts.branches;
+			++depth;
+			counts.depth = depth > counts.depth ? depth : counts.depth;
+		}
+		else if (depth > 0) {
+			--depth;
+		}
+	}
+}
+
+bool LSpecies::PredictTurtle(int iterations, TurtleCounts& counts) const
+{
+	if (!growthExact) {
+		return false;
+	}
+	std::vector<uint64_t> glyphCounts;
+	PredictGrowth(iterations, nullptr, &glyphCounts);
+	counts = TurtleCounts();
+	for (size_t i = 0; i < growthGlyphs.size(); ++i) {
+		const size_t count = (size_t)glyphCounts[i];
+		switch (ToSymbol((char)growthGlyphs[i]))
+		{
+		case LSymbol::Segment:
+			counts.segments += count;
+			break;
+		case LSymbol::Tip:
+			counts.tips += count;
+			break;
+		case LSymbol::Leaf:
+			counts.leaves += count;
+			break;
+		case LSymbol::Push:
+			counts.branches += count;
+			break;
+		default:
+			break;
+		}
+	}
+	return true;
+}
+
+std::vector<Mesh*> LSpecies::CreateMeshes(Turtle& turtle, size_t detailCount, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context) const
+{
+	std::vector<Mesh*> meshes(detailCount, nullptr);
+	for (size_t l = 0; l < turtle.levels.size(); ++l) {
+		Level& level = turtle.levels[l];
+		if (!level.indices.empty()) {
+			meshes[l] = new Mesh(&level.vertices[0], (unsigned int)level.vertices.size(), &level.indices[0], (unsigned int)level.indices.size(), device, context, buildStreams);
+		}
+	}
+	return meshes;
+}
+
+InstancedMesh* LSpecies::BuildInstanced(const LString& rule, Mesh* segmentMesh, Microsoft::WRL::ComPtr<ID3D11Device> device, Foliage* foliage, LBranchBounds* bounds, LBuildArena* arena)
+{
+	TurtleCounts counts;
+	CountTurtle(rule.symbols.data(), rule.symbols.size(), counts);
+	//splitting the string up needs its bracket index, so one too long to index is traced whole
+	if (buildThreads > 1 && rule.symbols.size() >= 2 * minModulesPerBranch && LBracketIndex::Fits(rule)) {
+		Turtle turtle(InitialState(), std::vector<Detail>(), true, foliage != nullptr, bounds != nullptr);
+		ArenaLease lease(*this, arena);
+		LBuildArena& buffers = lease.Arena();
+		turtle.Borrow(buffers.At(0));
+		turtle.Reserve(counts);
+		TraceParallel(rule, turtle, buffers);
+		CreateRecorded(turtle, foliage, bounds, device);
+		InstancedMesh* instances = CreateInstances(turtle, segmentMesh, device);
+		turtle.Return(buffers.At(0));
+		return instances;
+	}
+	LStringReader reader(rule, arity, parametric);
+	return InterpretInstanced(reader, &counts, segmentMesh, device, foliage, bounds, ArenaLease(*this, arena).Arena());
+}
+
+InstancedMesh* LSpecies::BuildInstanced(int iterations, uint32_t seed, Mesh* segmentMesh, Microsoft::WRL::ComPtr<ID3D11Device> device, Foliage* foliage, LBranchBounds* bounds, LBuildArena* arena)
+{
+	iterations = CapIterations(iterations, !growCacheDirectory.empty());
+	if (IsGrown(iterations, seed) || !growCacheDirectory.empty()) {
+		return BuildInstanced(GrowCapped(iterations, seed), segmentMesh, device, foliage, bounds, arena);
+	}
+	if (contextSensitive) {
+		LString grown;
+		LString scratch;
+		GrowCapped(iterations, seed, grown, scratch);
+		return BuildInstanced(grown, segmentMesh, device, foliage, bounds, arena);
+	}
+	TurtleCounts counts;
+	const bool counted = PredictTurtle(iterations, counts);
+	LExpander expander(*this, iterations, seed);
+	return InterpretInstanced(expander, counted ? &counts : nullptr, segmentMesh, device, foliage, bounds, ArenaLease(*this, arena).Arena());
+}
+
+InstancedMesh* LSpecies::BuildInstanced(const LTurtleProgram& program, Mesh* segmentMesh, Microsoft::WRL::ComPtr<ID3D11Device> device, Foliage* foliage, LBranchBounds* bounds, LBuildArena* arena)
+{
+	const TurtleCounts counts = { program.segments, program.tips, program.leaves, program.branches, program.depth };
+	return InterpretInstanced(program, &counts, segmentMesh, device, foliage, bounds, ArenaLease(*this, arena).Arena());
+}
+
+InstancedMesh* LSpecies::CreateInstances(Turtle& turtle, Mesh* segmentMesh, Microsoft::WRL::ComPtr<ID3D11Device> device)
+{
+	if (turtle.instances.empty()) {
+		return nullptr;
+	}
+	return new InstancedMesh(segmentMesh, &turtle.instances[0], sizeof(SegmentInstance), (unsigned int)turtle.instances.size(), device);
+}
+
+void LSpecies::CreateRecorded(Turtle& turtle, Foliage* foliage, LBranchBounds* bounds, Microsoft::WRL::ComPtr<ID3D11Device> device)
+{
+	if (foliage != nullptr) {
+		foliage->leaves = turtle.leaves.empty() ? nullptr : new InstancedMesh(foliage->mesh, &turtle.leaves[0], sizeof(LeafInstance), (unsigned int)turtle.leaves.size(), device);
+	}
+	if (bounds != nullptr) {
+		bounds->Assemble(turtle.bounds);
+	}
+}
+
+// Appends a ring of vertices at center, offset by a ring placed with LRing::Place, at texture row v.
+// Returns the index of its first vertex.
+static unsigned int AppendRing(std::vector<Vertex>& vertices, const LRing& ring, const LRing::Offsets& offsets, const DirectX::XMFLOAT3& center, float v)
+{
+	const unsigned int first = (unsigned int)vertices.size();
+	const unsigned int sides = ring.Sides();
+	for (unsigned int j = 0; j < sides; j++) {
+		Vertex vert = {};
+		vert.Normal = DirectX::XMFLOAT3(offsets.x[j], offsets.y[j], offsets.z[j]);
+		vert.Position = DirectX::XMFLOAT3(center.x + offsets.x[j], center.y + offsets.y[j], center.z + offsets.z[j]);
+		vert.UV = DirectX::XMFLOAT2(j / (float)(sides - 1), v);
+		vertices.push_back(vert);
+	}
+	return first;
+}
+
+// Appends the ring a segment starts from at center, unless the turtle is still standing on the top
+// ring of a segment of the same radius at this level, with no turn or branch since, which is where
+// this one would go anyway.  Returns the first vertex of the ring.
+static unsigned int BottomRing(std::vector<Vertex>& vertices, const LRing& ring, const LRing::Offsets& offsets, uint32_t standingOn, bool sameRadius, const DirectX::XMFLOAT3& center)
+{
+	if (standingOn != LFooting::NoRing && sameRadius) {
+		return standingOn;
 	}
-	return rule;
+	return AppendRing(vertices, ring, offsets, center, 0);
 }
 
-Mesh* LSpecies::Build(const std::string& rule, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context)
+// Appends the triangles joining two rings of numSides vertices
+static void AppendSides(std::vector<unsigned int>& indices, unsigned int bottom, unsigned int top, unsigned int numSides)
 {
-	DirectX::XMFLOAT4X4 initRotation;
-	DirectX::XMStoreFloat4x4(&initRotation, DirectX::XMMatrixRotationRollPitchYaw(DirectX::XM_PIDIV2, 0, 0));
-	LState state(DirectX::XMFLOAT3(0, 0, 0), initRotation, initialThickness, initialLimbLength);
-	std::vector<LState>* savedStates = new std::vector<LState>();
-	const int numSides = 8;
+	for (unsigned int j = 0; j < numSides; ++j) {
+		const unsigned int next = j == numSides - 1 ? 0 : j + 1;
+		indices.push_back(bottom + j);
+		indices.push_back(top + next);
+		indices.push_back(top + j);
+
+		indices.push_back(bottom + j);
+		indices.push_back(bottom + next);
+		indices.push_back(top + next);
+	}
+}
+
+Mesh* LSpecies::BuildSegmentMesh(unsigned int sides, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context)
+{
+	//the same rings the turtle draws, for a segment standing on the origin along z
+	const LRing ring(sides);
+	const float right[3] = { 1, 0, 0 };
+	const float up[3] = { 0, 1, 0 };
+	LRing::Offsets offsets;
+	ring.Place(right, up, 1, offsets);
 	std::vector<Vertex> vertices;
 	std::vector<unsigned int> indices;
-	unsigned int vertexIndex = 0;
-	for (unsigned int i = 0; i < rule.length(); ++i) {
-		const DirectX::XMFLOAT3 forward = DirectX::XMFLOAT3(state.direction._13, state.direction._23, state.direction._33);
-		const DirectX::XMFLOAT3 right = DirectX::XMFLOAT3(state.direction._11, state.direction._21, state.direction._31);
-		DirectX::XMFLOAT3 oldForward;
-		if (savedStates->size() >= 1) {
-			LState prev = savedStates->back();
-			oldForward = DirectX::XMFLOAT3(prev.direction._13, prev.direction._23, prev.direction._33);
-		}
-		switch (rule[i])
+	const unsigned int bottom = AppendRing(vertices, ring, offsets, DirectX::XMFLOAT3(0, 0, 0), 0);
+	const unsigned int top = AppendRing(vertices, ring, offsets, DirectX::XMFLOAT3(0, 0, 1), 1);
+	AppendSides(indices, bottom, top, ring.Sides());
+	return new Mesh(&vertices[0], (unsigned int)vertices.size(), &indices[0], (unsigned int)indices.size(), device, context);
+}
+
+Mesh* LSpecies::BuildLeafMesh(Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context)
+{
+	//the back is a copy of the front wound the other way, so culling leaves whichever side faces away
+	Vertex vertices[8] = {};
+	const DirectX::XMFLOAT3 corners[4] = { DirectX::XMFLOAT3(-0.5f, 0, 0), DirectX::XMFLOAT3(0.5f, 0, 0), DirectX::XMFLOAT3(0.5f, 0, 1), DirectX::XMFLOAT3(-0.5f, 0, 1) };
+	const DirectX::XMFLOAT2 uvs[4] = { DirectX::XMFLOAT2(0, 1), DirectX::XMFLOAT2(1, 1), DirectX::XMFLOAT2(1, 0), DirectX::XMFLOAT2(0, 0) };
+	for (int i = 0; i < 4; ++i) {
+		vertices[i].Position = vertices[i + 4].Position = corners[i];
+		vertices[i].UV = vertices[i + 4].UV = uvs[i];
+		vertices[i].Normal = DirectX::XMFLOAT3(0, 1, 0);
+		vertices[i + 4].Normal = DirectX::XMFLOAT3(0, -1, 0);
+	}
+	unsigned int indices[12] = { 0, 3, 1, 3, 2, 1, 4, 5, 7, 7, 5, 6 };
+	return new Mesh(vertices, 8, indices, 12, device, context);
+}
+
+LState LSpecies::InitialState() const
+{
+	//forward starts out along world y
+	DirectX::XMFLOAT4 initRotation;
+	DirectX::XMStoreFloat4(&initRotation, DirectX::XMQuaternionRotationAxis(DirectX::XMVectorSet(1, 0, 0, 0), -DirectX::XM_PIDIV2));
+	return LState(DirectX::XMFLOAT3(0, 0, 0), initRotation, initialThickness, initialLimbLength);
+}
+
+// Quaternion turning by the angle whose half has the given sine and cosine, about a unit axis
+static DirectX::XMVECTOR RotationAbout(DirectX::FXMVECTOR axis, float halfSine, float halfCosine)
+{
+	DirectX::XMFLOAT4 rotation;
+	DirectX::XMStoreFloat4(&rotation, DirectX::XMVectorScale(axis, halfSine));
+	rotation.w = halfCosine;
+	return DirectX::XMLoadFloat4(&rotation);
+}
+
+// Turns the turtle by rotation, in world space, renormalizing so rounding can't build up along a branch
+static void Turn(LState& state, LFooting& footing, DirectX::FXMVECTOR rotation)
+{
+	DirectX::XMStoreFloat4(&state.orientation, DirectX::XMQuaternionNormalize(DirectX::XMQuaternionMultiply(DirectX::XMLoadFloat4(&state.orientation), rotation)));
+	//the next segment kinks, so it needs rings of its own
+	footing.Clear();
+}
+
+// Box around a segment or tip along forward from bottom to top, whose radius goes from bottomRadius
+// to topRadius.  A circle facing forward reaches radius * sqrt(1 - forward[i]^2) along axis i, so
+// the box only has to hold the circles at either end.
+static LBranchBounds::Box SegmentBounds(const DirectX::XMFLOAT3& bottom, const DirectX::XMFLOAT3& top, DirectX::FXMVECTOR forward, float bottomRadius, float topRadius)
+{
+	const DirectX::XMVECTOR reach = DirectX::XMVectorSqrt(DirectX::XMVectorMax(DirectX::XMVectorSubtract(DirectX::XMVectorReplicate(1), DirectX::XMVectorMultiply(forward, forward)), DirectX::XMVectorZero()));
+	const DirectX::XMVECTOR bottomReach = DirectX::XMVectorScale(reach, bottomRadius);
+	const DirectX::XMVECTOR topReach = DirectX::XMVectorScale(reach, topRadius);
+	const DirectX::XMVECTOR b = DirectX::XMLoadFloat3(&bottom);
+	const DirectX::XMVECTOR t = DirectX::XMLoadFloat3(&top);
+	LBranchBounds::Box box;
+	DirectX::XMStoreFloat3(&box.min, DirectX::XMVectorMin(DirectX::XMVectorSubtract(b, bottomReach), DirectX::XMVectorSubtract(t, topReach)));
+	DirectX::XMStoreFloat3(&box.max, DirectX::XMVectorMax(DirectX::XMVectorAdd(b, bottomReach), DirectX::XMVectorAdd(t, topReach)));
+	return box;
+}
+
+template <class ModuleSource>
+std::vector<Mesh*> LSpecies::Interpret(ModuleSource& modules, const TurtleCounts* counts, const std::vector<Detail>& details, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, Foliage* foliage, LBranchBounds* bounds, LBuildArena& arena) const
+{
+	Turtle turtle(InitialState(), details, false, foliage != nullptr, bounds != nullptr);
+	turtle.Borrow(arena.At(0));
+	if (counts != nullptr) {
+		turtle.Reserve(*counts);
+	}
+	Trace(modules, turtle);
+	CreateRecorded(turtle, foliage, bounds, device);
+	const std::vector<Mesh*> meshes = CreateMeshes(turtle, details.size(), device, context);
+	turtle.Return(arena.At(0));
+	return meshes;
+}
+
+template <class ModuleSource>
+InstancedMesh* LSpecies::InterpretInstanced(ModuleSource& modules, const TurtleCounts* counts, Mesh* segmentMesh, Microsoft::WRL::ComPtr<ID3D11Device> device, Foliage* foliage, LBranchBounds* bounds, LBuildArena& arena) const
+{
+	Turtle turtle(InitialState(), std::vector<Detail>(), true, foliage != nullptr, bounds != nullptr);
+	turtle.Borrow(arena.At(0));
+	if (counts != nullptr) {
+		turtle.Reserve(*counts);
+	}
+	Trace(modules, turtle);
+	CreateRecorded(turtle, foliage, bounds, device);
+	InstancedMesh* instances = CreateInstances(turtle, segmentMesh, device);
+	turtle.Return(arena.At(0));
+	return instances;
+}
+
+// Rolls turn about the forward axis of the state saved when the branch opened, or of the turtle
+// itself on the trunk
+static DirectX::XMVECTOR RollAxis(const LState& state, const std::vector<LState>& savedStates)
+{
+	const DirectX::XMFLOAT4& parent = savedStates.empty() ? state.orientation : savedStates.back().orientation;
+	return DirectX::XMVector3Rotate(DirectX::XMVectorSet(0, 0, 1, 0), DirectX::XMLoadFloat4(&parent));
+}
+
+void LSpecies::CompileTurns()
+{
+	const DirectX::XMVECTOR worldZ = DirectX::XMVectorSet(0, 0, 1, 0);
+	float inclinationSine, inclinationCosine;
+	DirectX::XMScalarSinCos(&inclinationSine, &inclinationCosine, deltaInclination / 2);
+	DirectX::XMScalarSinCos(&rollHalfSine, &rollHalfCosine, deltaAzimuth / 2);
+	DirectX::XMStoreFloat4(&pitchDownRotation, RotationAbout(worldZ, -inclinationSine, inclinationCosine));
+	DirectX::XMStoreFloat4(&pitchUpRotation, RotationAbout(worldZ, inclinationSine, inclinationCosine));
+}
+
+void LSpecies::DrawSegment(Turtle& turtle, float length, float thickness)
+{
+	LState& state = turtle.state;
+	LFooting& footing = turtle.footing;
+	std::vector<Level>& levels = turtle.levels;
+	//the turtle's axes are only needed to draw: right, up and forward are the rows of its rotation
+	DirectX::XMFLOAT3X3 axes;
+	const DirectX::XMMATRIX frame = DirectX::XMMatrixRotationQuaternion(DirectX::XMLoadFloat4(&state.orientation));
+	DirectX::XMStoreFloat3x3(&axes, frame);
+	const DirectX::XMVECTOR forward = frame.r[2];
+	const float* right = axes.m[0];
+	const float* up = axes.m[1];
+	const float radius = thickness / 2;
+	const bool sameRadius = footing.radius == radius;
+	LRing::Offsets offsets;
+	//carrying straight on at the same radius starts from the last segment's top, as shared rings do
+	const bool carryOn = footing.onSegment && sameRadius;
+	const DirectX::XMFLOAT3 from = state.position;
+	DirectX::XMStoreFloat3(&state.position, DirectX::XMVectorAdd(DirectX::XMLoadFloat3(&state.position), DirectX::XMVectorScale(forward, -0.05f))); //pull branches back
+	const DirectX::XMFLOAT3 base = state.position;
+	//move draw position forward by length
+	DirectX::XMStoreFloat3(&state.position, DirectX::XMVectorAdd(DirectX::XMLoadFloat3(&state.position), DirectX::XMVectorScale(forward, length)));
+	if (turtle.instanced) {
+		const SegmentInstance instance = { state.orientation, carryOn ? from : base, carryOn ? length - 0.05f : length, radius, radius };
+		turtle.instances.push_back(instance);
+	}
+	if (turtle.recordBounds) {
+		turtle.bounds.segments.push_back(SegmentBounds(carryOn ? from : base, state.position, forward, radius, radius));
+	}
+	for (size_t l = 0; l < levels.size(); ++l) {
+		Level& level = levels[l];
+		if (thickness < level.minThickness) {
+			footing.rings[l] = LFooting::NoRing;
+			continue;
+		}
+		//both rings share the frame, so they're placed once
+		level.ring.Place(right, up, radius, offsets);
+		//construct ring of verts around the base, or carry on from the last segment's
+		const unsigned int bottom = BottomRing(level.vertices, level.ring, offsets, footing.rings[l], sameRadius, base);
+		const float v = level.vertices[bottom].UV.y;
+		// construct ring of verts around new draw pos, a texture tile further along
+		const unsigned int top = AppendRing(level.vertices, level.ring, offsets, state.position, v + 1);
+		AppendSides(level.indices, bottom, top, level.ring.Sides());
+		footing.rings[l] = top;
+	}
+	footing.radius = radius;
+	footing.onSegment = true;
+}
+
+void LSpecies::DrawTip(Turtle& turtle, float length, float thickness)
+{
+	LState& state = turtle.state;
+	LFooting& footing = turtle.footing;
+	std::vector<Level>& levels = turtle.levels;
+	DirectX::XMFLOAT3X3 axes;
+	const DirectX::XMMATRIX frame = DirectX::XMMatrixRotationQuaternion(DirectX::XMLoadFloat4(&state.orientation));
+	DirectX::XMStoreFloat3x3(&axes, frame);
+	const DirectX::XMVECTOR forward = frame.r[2];
+	const float* right = axes.m[0];
+	const float* up = axes.m[1];
+	const float radius = thickness / 2;
+	const bool sameRadius = footing.radius == radius;
+	LRing::Offsets offsets;
+	const bool carryOn = footing.onSegment && sameRadius;
+	const DirectX::XMFLOAT3 from = state.position;
+	DirectX::XMStoreFloat3(&state.position, DirectX::XMVectorAdd(DirectX::XMLoadFloat3(&state.position), DirectX::XMVectorScale(forward, -0.025f)));			//construct ring of verts around current draw pos
+	const DirectX::XMFLOAT3 base = state.position;
+	DirectX::XMStoreFloat3(&state.position, DirectX::XMVectorAdd(DirectX::XMLoadFloat3(&state.position), DirectX::XMVectorScale(forward, 0.4*length)));
+	//capped with a cone to a single vertex
+	Vertex tipVertex = {};
+	tipVertex.Position = state.position;
+	DirectX::XMStoreFloat3(&tipVertex.Normal, forward);
+	if (turtle.instanced) {
+		const SegmentInstance instance = { state.orientation, carryOn ? from : base, carryOn ? 0.4f * length - 0.025f : 0.4f * length, radius, 0 };
+		turtle.instances.push_back(instance);
+	}
+	if (turtle.recordBounds) {
+		turtle.bounds.segments.push_back(SegmentBounds(carryOn ? from : base, state.position, forward, radius, 0));
+	}
+	for (size_t l = 0; l < levels.size(); ++l) {
+		Level& level = levels[l];
+		if (thickness < level.minThickness) {
+			continue;
+		}
+		const unsigned int numSides = level.ring.Sides();
+		level.ring.Place(right, up, radius, offsets);
+		const unsigned int bottom = BottomRing(level.vertices, level.ring, offsets, footing.rings[l], sameRadius, base);
+		tipVertex.UV = DirectX::XMFLOAT2(0.5f, level.vertices[bottom].UV.y + 1);
+		const unsigned int tip = (unsigned int)level.vertices.size();
+		level.vertices.push_back(tipVertex);
+		for (unsigned int j = 0; j < numSides; ++j) {
+			level.indices.push_back(bottom + j);
+			level.indices.push_back(bottom + (j == numSides - 1 ? 0 : j + 1));
+			level.indices.push_back(tip);
+		}
+	}
+	footing.Clear();
+}
+
+void LSpecies::OpenBranch(Turtle& turtle)
+{
+	turtle.savedStates.push_back(turtle.state);
+	//the parent only needs its footing back if it was standing on a segment it can carry on from
+	if (turtle.footing.onSegment) {
+		turtle.footing.depth = turtle.savedStates.size();
+		turtle.savedFootings.push_back(turtle.footing);
+	}
+	//a branch draws its own rings, so the parent's are only ever shared within one turtle
+	turtle.footing.Clear();
+	if (turtle.recordBounds) {
+		turtle.bounds.Open();
+	}
+}
+
+void LSpecies::CloseBranch(Turtle& turtle)
+{
+	//a ']' with no '[' is ignored, as CountTurtle and LBranchBounds do
+	if (turtle.savedStates.empty()) {
+		return;
+	}
+	turtle.state = turtle.savedStates.back();
+	if (!turtle.savedFootings.empty() && turtle.savedFootings.back().depth == turtle.savedStates.size()) {
+		turtle.footing = turtle.savedFootings.back();
+		turtle.savedFootings.pop_back();
+	}
+	else {
+		turtle.footing.Clear();
+	}
+	turtle.savedStates.pop_back();
+	if (turtle.recordBounds) {
+		turtle.bounds.Close();
+	}
+}
+
+void LSpecies::AddLeaf(Turtle& turtle, float size)
+{
+	//leaves hang where the turtle is, facing its up
+	if (turtle.recordLeaves) {
+		const LeafInstance leaf = { turtle.state.orientation, turtle.state.position, size };
+		turtle.leaves.push_back(leaf);
+	}
+}
+
+// Moves the turtle through modules, appending what it draws at each of its levels of detail.  The
+// turtle only walks the string once; each level just draws the same segments with its own ring, or
+// leaves them out.  Indices are numbered from the vertices the turtle already has, so tracing can
+// pick up where an earlier call left off.
+template <class ModuleSource>
+void LSpecies::Trace(ModuleSource& modules, Turtle& turtle) const
+{
+	LState& state = turtle.state;
+	//+ and - turn about world z, < and > about the forward axis of the branch the turtle is in
+	const DirectX::XMVECTOR worldZ = DirectX::XMVectorSet(0, 0, 1, 0);
+	const DirectX::XMVECTOR pitchDown = DirectX::XMLoadFloat4(&pitchDownRotation);
+	const DirectX::XMVECTOR pitchUp = DirectX::XMLoadFloat4(&pitchUpRotation);
+	char glyph;
+	const float* arguments;
+	unsigned int argumentCount;
+	while (modules.Next(glyph, arguments, argumentCount)) {
+		//a module's parameters override the species' defaults for that one symbol
+		const LSymbol symbol = ToSymbol(glyph);
+		float halfSine = rollHalfSine;
+		float halfCosine = rollHalfCosine;
+		if (argumentCount > 0 && symbol >= LSymbol::PitchDown && symbol <= LSymbol::RollLeft) {
+			DirectX::XMScalarSinCos(&halfSine, &halfCosine, arguments[0] / 2);
+		}
+		switch (symbol)
+		{
+		case LSymbol::Segment:
+			DrawSegment(turtle, argumentCount > 0 ? arguments[0] : state.length, argumentCount > 1 ? arguments[1] : state.thickness);
+			break;
+		case LSymbol::Tip:
+			DrawTip(turtle, argumentCount > 0 ? arguments[0] : state.length, argumentCount > 1 ? arguments[1] : state.thickness);
+			break;
+		case LSymbol::PitchDown:
+			Turn(state, turtle.footing, argumentCount > 0 ? RotationAbout(worldZ, -halfSine, halfCosine) : pitchDown);
+			break;
+		case LSymbol::PitchUp:
+			Turn(state, turtle.footing, argumentCount > 0 ? RotationAbout(worldZ, halfSine, halfCosine) : pitchUp);
+			break;
+		case LSymbol::RollRight:
+			Turn(state, turtle.footing, RotationAbout(RollAxis(state, turtle.savedStates), -halfSine, halfCosine));
+			break;
+		case LSymbol::RollLeft:
+			Turn(state, turtle.footing, RotationAbout(RollAxis(state, turtle.savedStates), halfSine, halfCosine));
+			break;
+		case LSymbol::Push:
+			OpenBranch(turtle);
+			break;
+		case LSymbol::Pop:
+			CloseBranch(turtle);
+			break;
+		case LSymbol::Leaf:
+			//half a limb long unless L(size) says
+			AddLeaf(turtle, argumentCount > 0 ? arguments[0] : state.length / 2);
+			break;
+		case LSymbol::ThicknessDecay:
+			state.thickness *= argumentCount > 0 ? arguments[0] : thicknessDecay;
+			break;
+		case LSymbol::LengthDecay:
+			state.length *= argumentCount > 0 ? arguments[0] : limbLengthDecay;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+// Records the modules the turtle acts on as ops, the way Trace would act on them.  Turns only ever
+// follow turns of the same kind in the same op: runs of + and -, which are all about world z, compose
+// into one quaternion, and runs of < and >, which share an axis until something else moves the
+// turtle, add up their angles.
+template <class ModuleSource>
+void LSpecies::CompileTurtle(ModuleSource& modules, LTurtleProgram& program) const
+{
+	program.Clear();
+	const DirectX::XMVECTOR worldZ = DirectX::XMVectorSet(0, 0, 1, 0);
+	size_t depth = 0;
+	char glyph;
+	const float* arguments;
+	unsigned int argumentCount;
+	while (modules.Next(glyph, arguments, argumentCount)) {
+		const LSymbol symbol = ToSymbol(glyph);
+		const bool afterTurn = !program.ops.empty() && program.ops.back().opcode == LTurtleOpcode::Turn;
+		const bool afterRoll = !program.ops.empty() && program.ops.back().opcode == LTurtleOpcode::Roll;
+		float halfSine = rollHalfSine;
+		float halfCosine = rollHalfCosine;
+		if (argumentCount > 0 && symbol >= LSymbol::PitchDown && symbol <= LSymbol::RollLeft) {
+			DirectX::XMScalarSinCos(&halfSine, &halfCosine, arguments[0] / 2);
+		}
+		LTurtleOpcode opcode;
+		unsigned int used = 0; //parameters the op reads
+		switch (symbol)
 		{
-		case 'F':
-			DirectX::XMStoreFloat3(&state.position, DirectX::XMVectorAdd(DirectX::XMLoadFloat3(&state.position), DirectX::XMVectorScale(DirectX::XMLoadFloat3(&forward), -0.05f))); //pull branches back
-			//construct ring of verts around current draw pos
-			for (int j = 0; j < numSides; j++) {
-				Vertex vert = {};
-				DirectX::XMStoreFloat3(&vert.Position, DirectX::XMVectorAdd(DirectX::XMLoadFloat3(&state.position), DirectX::XMVector3Transform(DirectX::XMVectorScale(DirectX::XMLoadFloat3(&right),state.thickness/2), DirectX::XMMatrixRotationAxis(DirectX::XMLoadFloat3(&forward), DirectX::XM_2PI * ((float)j) / numSides))));
-				DirectX::XMStoreFloat3(&vert.Normal, DirectX::XMVector3Transform(DirectX::XMVectorScale(DirectX::XMLoadFloat3(&right), state.thickness / 2), DirectX::XMMatrixRotationAxis(DirectX::XMLoadFloat3(&forward), DirectX::XM_2PI * ((float)j) / numSides)));
-				vert.UV = DirectX::XMFLOAT2(j/(float)(numSides-1), 0);
-				vertices.push_back(vert);
-			}
-			//move draw position forward by length
-			DirectX::XMStoreFloat3(&state.position, DirectX::XMVectorAdd(DirectX::XMLoadFloat3(&state.position), DirectX::XMVectorScale(DirectX::XMLoadFloat3(&forward), state.length)));
-			// construct ring of verts around new draw pos
-			for (unsigned int j = 0; j < numSides; j++) {
-				Vertex vert = {};
-				DirectX::XMStoreFloat3(&vert.Position, DirectX::XMVectorAdd(DirectX::XMLoadFloat3(&state.position), DirectX::XMVector3Transform(DirectX::XMVectorScale(DirectX::XMLoadFloat3(&right), state.thickness / 2), DirectX::XMMatrixRotationAxis(DirectX::XMLoadFloat3(&forward), DirectX::XM_2PI * ((float)j) / numSides))));
-				DirectX::XMStoreFloat3(&vert.Normal, DirectX::XMVector3Transform(DirectX::XMVectorScale(DirectX::XMLoadFloat3(&right), state.thickness / 2), DirectX::XMMatrixRotationAxis(DirectX::XMLoadFloat3(&forward), DirectX::XM_2PI * ((float)j) / numSides)));
-				vert.UV = DirectX::XMFLOAT2(j / (float)(numSides-1), 1);
-				vertices.push_back(vert);
-			}
-			for (unsigned int j = vertexIndex; j < vertexIndex + numSides; ++j) {
-				indices.push_back(j);
-				indices.push_back((j == vertexIndex + numSides - 1) ? vertexIndex + numSides : j + numSides + 1);
-				indices.push_back(j + numSides);
-				
-				indices.push_back(j);
-				indices.push_back((j == vertexIndex + numSides - 1) ? vertexIndex : j + 1);
-				indices.push_back((j == vertexIndex + numSides - 1) ? vertexIndex + numSides : j + numSides + 1);
-			} 
-
-			vertexIndex += numSides * 2;
-			break;
-		case 'X':
-			DirectX::XMStoreFloat3(&state.position, DirectX::XMVectorAdd(DirectX::XMLoadFloat3(&state.position), DirectX::XMVectorScale(DirectX::XMLoadFloat3(&forward), -0.025f)));			//construct ring of verts around current draw pos
-			for (int j = 0; j < numSides; j++) {
-				Vertex vert = {};
-				DirectX::XMStoreFloat3(&vert.Position, DirectX::XMVectorAdd(DirectX::XMLoadFloat3(&state.position), DirectX::XMVector3Transform(DirectX::XMVectorScale(DirectX::XMLoadFloat3(&right), state.thickness / 2), DirectX::XMMatrixRotationAxis(DirectX::XMLoadFloat3(&forward), DirectX::XM_2PI * ((float)j) / numSides))));
-				DirectX::XMStoreFloat3(&vert.Normal, DirectX::XMVector3Transform(DirectX::XMVectorScale(DirectX::XMLoadFloat3(&right), state.thickness / 2), DirectX::XMMatrixRotationAxis(DirectX::XMLoadFloat3(&forward), DirectX::XM_2PI * ((float)j) / numSides)));
-				vert.UV = DirectX::XMFLOAT2(j / (float)(numSides - 1), 0);
-				vertices.push_back(vert);
-			}
-			DirectX::XMStoreFloat3(&state.position, DirectX::XMVectorAdd(DirectX::XMLoadFloat3(&state.position), DirectX::XMVectorScale(DirectX::XMLoadFloat3(&forward), 0.4*state.length)));
+		case LSymbol::PitchDown:
+		case LSymbol::PitchUp:
 			{
-				Vertex tipVertex = {};
-				tipVertex.Position = state.position;
-				for (unsigned int j = 0; j < numSides; j++) {
-					Vertex vert = tipVertex;
-					DirectX::XMStoreFloat3(&vert.Normal, DirectX::XMVector3Transform(DirectX::XMVectorScale(DirectX::XMLoadFloat3(&right), state.thickness / 2), DirectX::XMMatrixRotationAxis(DirectX::XMLoadFloat3(&forward), DirectX::XM_2PI * ((float)j) / numSides)));
-					vert.UV = DirectX::XMFLOAT2(j / (float)(numSides - 1), 1);
-					vertices.push_back(vert);
+				const DirectX::XMVECTOR rotation = argumentCount > 0 ? RotationAbout(worldZ, symbol == LSymbol::PitchDown ? -halfSine : halfSine, halfCosine)
+					: DirectX::XMLoadFloat4(symbol == LSymbol::PitchDown ? &pitchDownRotation : &pitchUpRotation);
+				if (!afterTurn) {
+					program.ops.push_back({ LTurtleOpcode::Turn, 0, (uint32_t)program.rotations.size() });
+					program.rotations.push_back(DirectX::XMFLOAT4(0, 0, 0, 1));
 				}
-				//DirectX::XMStoreFloat3(&tipVertex.Normal, DirectX::XMLoadFloat3(&forward));
-				//tipVertex.UV = DirectX::XMFLOAT2(0.5f, 1);
-				for (unsigned int j = vertexIndex; j < vertexIndex + numSides; ++j) {
-					indices.push_back(j);
-					indices.push_back((j == vertexIndex + numSides - 1) ? vertexIndex + numSides : j + numSides + 1);
-					indices.push_back(j + numSides);
-
-					indices.push_back(j);
-					indices.push_back((j == vertexIndex + numSides - 1) ? vertexIndex : j + 1);
-					indices.push_back((j == vertexIndex + numSides - 1) ? vertexIndex + numSides : j + numSides + 1);
+				//Turn applies the rotation after the turtle's, so the earlier turn comes first
+				DirectX::XMFLOAT4& composed = program.rotations[program.ops.back().operand];
+				DirectX::XMStoreFloat4(&composed, DirectX::XMQuaternionNormalize(DirectX::XMQuaternionMultiply(DirectX::XMLoadFloat4(&composed), rotation)));
+			}
+			continue;
+		case LSymbol::RollRight:
+		case LSymbol::RollLeft:
+			{
+				const float sine = symbol == LSymbol::RollRight ? -halfSine : halfSine;
+				if (!afterRoll) {
+					program.ops.push_back({ LTurtleOpcode::Roll, 0, (uint32_t)program.rotations.size() });
+					program.rotations.push_back(DirectX::XMFLOAT4(0, 1, 0, 0));
 				}
+				//the half angles add
+				DirectX::XMFLOAT4& composed = program.rotations[program.ops.back().operand];
+				const float composedSine = composed.x * halfCosine + composed.y * sine;
+				composed.y = composed.y * halfCosine - composed.x * sine;
+				composed.x = composedSine;
+			}
+			continue;
+		case LSymbol::Segment:
+			opcode = LTurtleOpcode::Segment;
+			used = 2;
+			++program.segments;
+			break;
+		case LSymbol::Tip:
+			opcode = LTurtleOpcode::Tip;
+			used = 2;
+			++program.tips;
+			break;
+		case LSymbol::Push:
+			opcode = LTurtleOpcode::Push;
+			++program.branches;
+			++depth;
+			program.depth = depth > program.depth ? depth : program.depth;
+			break;
+		case LSymbol::Pop:
+			opcode = LTurtleOpcode::Pop;
+			if (depth > 0) {
+				--depth;
 			}
-			vertexIndex += numSides*2;
 			break;
-		case '+':
-			DirectX::XMStoreFloat4x4(&state.direction, DirectX::XMMatrixMultiply(DirectX::XMMatrixRotationRollPitchYaw(0, 0, deltaInclination), DirectX::XMLoadFloat4x4(&state.direction)));
+		case LSymbol::Leaf:
+			opcode = LTurtleOpcode::Leaf;
+			used = 1;
+			++program.leaves;
 			break;
-		case '-':
-			DirectX::XMStoreFloat4x4(&state.direction, DirectX::XMMatrixMultiply(DirectX::XMMatrixRotationRollPitchYaw(0, 0, -deltaInclination), DirectX::XMLoadFloat4x4(&state.direction)));
+		case LSymbol::ThicknessDecay:
+			opcode = LTurtleOpcode::ThicknessDecay;
+			used = 1;
 			break;
-		case '>':
-			DirectX::XMStoreFloat4x4(&state.direction, DirectX::XMMatrixMultiply(DirectX::XMMatrixRotationAxis(DirectX::XMLoadFloat3(&oldForward), deltaAzimuth), DirectX::XMLoadFloat4x4(&state.direction)));
+		case LSymbol::LengthDecay:
+			opcode = LTurtleOpcode::LengthDecay;
+			used = 1;
 			break;
-		case '<':
-			DirectX::XMStoreFloat4x4(&state.direction, DirectX::XMMatrixMultiply(DirectX::XMMatrixRotationAxis(DirectX::XMLoadFloat3(&oldForward), -deltaAzimuth), DirectX::XMLoadFloat4x4(&state.direction)));
+		default:
+			continue;
+		}
+		used = argumentCount < used ? argumentCount : used;
+		program.ops.push_back({ opcode, (uint8_t)used, (uint32_t)program.arguments.size() });
+		program.arguments.insert(program.arguments.end(), arguments, arguments + used);
+	}
+}
+
+void LSpecies::Trace(const LTurtleProgram& program, Turtle& turtle) const
+{
+	LState& state = turtle.state;
+	const float* arguments = program.arguments.data();
+	const DirectX::XMFLOAT4* rotations = program.rotations.data();
+	for (const LTurtleOp& op : program.ops) {
+		const float* own = op.argumentCount > 0 ? arguments + op.operand : nullptr;
+		switch (op.opcode)
+		{
+		case LTurtleOpcode::Segment:
+			DrawSegment(turtle, op.argumentCount > 0 ? own[0] : state.length, op.argumentCount > 1 ? own[1] : state.thickness);
 			break;
-		case '[':
-			savedStates->push_back(state);
+		case LTurtleOpcode::Tip:
+			DrawTip(turtle, op.argumentCount > 0 ? own[0] : state.length, op.argumentCount > 1 ? own[1] : state.thickness);
 			break;
-		case ']':
-			state = savedStates->back();
-			savedStates->pop_back();
+		case LTurtleOpcode::Turn:
+			Turn(state, turtle.footing, DirectX::XMLoadFloat4(&rotations[op.operand]));
 			break;
-		case '#':
-			state.thickness *= thicknessDecay;
+		case LTurtleOpcode::Roll:
+			Turn(state, turtle.footing, RotationAbout(RollAxis(state, turtle.savedStates), rotations[op.operand].x, rotations[op.operand].y));
 			break;
-		case '$':
-			state.length *= limbLengthDecay;
+		case LTurtleOpcode::Push:
+			OpenBranch(turtle);
 			break;
-		default:
+		case LTurtleOpcode::Pop:
+			CloseBranch(turtle);
+			break;
+		case LTurtleOpcode::Leaf:
+			AddLeaf(turtle, op.argumentCount > 0 ? own[0] : state.length / 2);
+			break;
+		case LTurtleOpcode::ThicknessDecay:
+			state.thickness *= op.argumentCount > 0 ? own[0] : thicknessDecay;
+			break;
+		case LTurtleOpcode::LengthDecay:
+			state.length *= op.argumentCount > 0 ? own[0] : limbLengthDecay;
 			break;
 		}
 	}
-	delete savedStates;
-	Mesh* mesh = new Mesh(&vertices[0], vertexIndex, &indices[0], indices.size(), device, context);
-	return mesh;
 }
 
-
+// Traces rule as Trace would, but hands branches to other threads.  Walking the spine of the tree
+// gives the state at the start of each branch, after which the branch is independent of everything
+// around it; the pieces are then stitched back together in string order, so the result is identical.
+void LSpecies::TraceParallel(const LString& rule, Turtle& turtle, LBuildArena& arena) const
+{
+	struct Branch {
+		size_t begin;
+		size_t end;
+		size_t spineVertices[LFooting::MaxDetails]; // how much the spine had drawn when the branch opened
+		size_t spineIndices[LFooting::MaxDetails];
+		size_t spineInstances;
+		size_t spineLeaves;
+		size_t spineBounds;
+		size_t spineBrackets;
+	};
+	const size_t length = rule.symbols.size();
+	const char* symbols = rule.symbols.data();
+	LBracketIndex& brackets = arena.brackets;
+	brackets.BuildBrackets(rule, arity);
+	//a branch holding more than a fair share of the tree is walked into instead, so a crown that all
+	//hangs off the first segment still spreads over every thread
+	const size_t share = length / (buildThreads * 4) > 2 * minModulesPerBranch ? length / (buildThreads * 4) : 2 * minModulesPerBranch;
+	Turtle spine(turtle.state, turtle);
+	spine.Borrow(arena.At(1));
+	spine.savedStates = turtle.savedStates;
+	spine.savedFootings = turtle.savedFootings;
+	//the spine numbers its vertices afresh, so it has no ring of turtle's to carry on from; instances
+	//aren't numbered, so they can
+	spine.footing = turtle.footing;
+	spine.footing.Clear();
+	spine.footing.onSegment = turtle.footing.onSegment;
+	const size_t levelCount = spine.levels.size();
+	std::vector<Branch> branches;
+	std::vector<Turtle> traced;
+	LStringReader reader(rule, arity, parametric);
+	size_t cursor = 0; //start of the spine not traced yet
+	size_t scan = 0;
+	while (cursor < length) {
+		const char* open = (const char*)memchr(symbols + scan, '[', length - scan);
+		const size_t position = open == nullptr ? length : open - symbols;
+		if (position < length) {
+			const uint32_t match = brackets.match[position];
+			const size_t branchLength = match == LBracketIndex::None ? 0 : match + 1 - position;
+			if (branchLength < minModulesPerBranch || branchLength > share) {
+				//too small to be worth a thread, or too big to be one; either way the spine continues into it
+				scan = branchLength < minModulesPerBranch && branchLength > 0 ? match + 1 : position + 1;
+				continue;
+			}
+		}
+		if (cursor < position) {
+			reader.Limit(cursor, position, brackets.parameterOffset[cursor]);
+			Trace(reader, spine);
+		}
+		if (position == length) {
+			break;
+		}
+		Branch branch = { position, brackets.match[position] + (size_t)1 };
+		for (size_t l = 0; l < levelCount; ++l) {
+			branch.spineVertices[l] = spine.levels[l].vertices.size();
+			branch.spineIndices[l] = spine.levels[l].indices.size();
+		}
+		branch.spineInstances = spine.instances.size();
+		branch.spineLeaves = spine.leaves.size();
+		branch.spineBounds = spine.bounds.segments.size();
+		branch.spineBrackets = spine.bounds.brackets.size();
+		branches.push_back(branch);
+		traced.push_back(Turtle(spine.state, spine));
+		cursor = scan = branches.back().end;
+	}
+	//every branch draws into an arena of its own, so they're all made before any thread takes one
+	arena.At(branches.size() + 1);
+	ParallelFor((unsigned int)branches.size(), buildThreads, [&](unsigned int k) {
+		traced[k].Borrow(arena.buffers[k + 2]);
+		TurtleCounts counts;
+		CountTurtle(symbols + branches[k].begin, branches[k].end - branches[k].begin, counts);
+		traced[k].Reserve(counts);
+		LStringReader branchReader(rule, arity, parametric);
+		branchReader.Limit(branches[k].begin, branches[k].end, brackets.parameterOffset[branches[k].begin]);
+		Trace(branchReader, traced[k]);
+	});
+	turtle.state = spine.state;
+	turtle.footing = spine.footing;
+	turtle.savedStates.assign(spine.savedStates.begin(), spine.savedStates.end()); //into the room it reserved
+	turtle.savedFootings.assign(spine.savedFootings.begin(), spine.savedFootings.end());
+	//instances and leaves refer to nothing else, so they only need putting back in order
+	auto stitch = [&](auto records, size_t Branch::* spineCount) {
+		auto& out = turtle.*records;
+		const auto& spineRecords = spine.*records;
+		size_t from = 0;
+		for (size_t k = 0; k < branches.size(); ++k) {
+			out.insert(out.end(), spineRecords.begin() + from, spineRecords.begin() + branches[k].*spineCount);
+			from = branches[k].*spineCount;
+			out.insert(out.end(), (traced[k].*records).begin(), (traced[k].*records).end());
+		}
+		out.insert(out.end(), spineRecords.begin() + from, spineRecords.end());
+	};
+	stitch(&Turtle::instances, &Branch::spineInstances);
+	stitch(&Turtle::leaves, &Branch::spineLeaves);
+	//bounds likewise, only their brackets count the segments before them
+	if (turtle.recordBounds) {
+		size_t segmentFrom = 0;
+		size_t bracketFrom = 0;
+		for (size_t k = 0; k < branches.size(); ++k) {
+			turtle.bounds.Append(spine.bounds, segmentFrom, branches[k].spineBounds, bracketFrom, branches[k].spineBrackets);
+			segmentFrom = branches[k].spineBounds;
+			bracketFrom = branches[k].spineBrackets;
+			const LBranchBounds::Recording& branch = traced[k].bounds;
+			turtle.bounds.Append(branch, 0, branch.segments.size(), 0, branch.brackets.size());
+		}
+		turtle.bounds.Append(spine.bounds, segmentFrom, spine.bounds.segments.size(), bracketFrom, spine.bounds.brackets.size());
+	}
+	//stitch spine and branches together in the order they occur, renumbering indices, one level at a time
+	for (size_t l = 0; l < levelCount; ++l) {
+		Level& out = turtle.levels[l];
+		const Level& spineLevel = spine.levels[l];
+		size_t vertexCount = spineLevel.vertices.size();
+		size_t indexCount = spineLevel.indices.size();
+		for (const Turtle& branch : traced) {
+			vertexCount += branch.levels[l].vertices.size();
+			indexCount += branch.levels[l].indices.size();
+		}
+		out.vertices.reserve(out.vertices.size() + vertexCount);
+		out.indices.reserve(out.indices.size() + indexCount);
+		//a spine segment can start from a ring drawn before the branches in between, so each piece of the
+		//spine keeps the offset its vertices moved by
+		std::vector<size_t> spineStarts(1, 0);
+		std::vector<unsigned int> spineOffsets;
+		size_t spineIndex = 0;
+		auto renumber = [&](unsigned int index) {
+			const size_t piece = std::upper_bound(spineStarts.begin(), spineStarts.end(), (size_t)index) - spineStarts.begin() - 1;
+			return index + spineOffsets[piece];
+		};
+		auto appendSpine = [&](size_t vertexEnd, size_t indexEnd) {
+			const size_t vertexBegin = spineStarts.back();
+			const unsigned int offset = (unsigned int)(out.vertices.size() - vertexBegin);
+			spineOffsets.push_back(offset);
+			out.vertices.insert(out.vertices.end(), spineLevel.vertices.begin() + vertexBegin, spineLevel.vertices.begin() + vertexEnd);
+			for (; spineIndex < indexEnd; ++spineIndex) {
+				const unsigned int index = spineLevel.indices[spineIndex];
+				out.indices.push_back(index < vertexBegin ? renumber(index) : index + offset);
+			}
+		};
+		for (size_t k = 0; k < branches.size(); ++k) {
+			appendSpine(branches[k].spineVertices[l], branches[k].spineIndices[l]);
+			spineStarts.push_back(branches[k].spineVertices[l]);
+			const Level& branchLevel = traced[k].levels[l];
+			const unsigned int offset = (unsigned int)out.vertices.size();
+			out.vertices.insert(out.vertices.end(), branchLevel.vertices.begin(), branchLevel.vertices.end());
+			for (unsigned int index : branchLevel.indices) {
+				out.indices.push_back(index + offset);
+			}
+		}
+		appendSpine(spineLevel.vertices.size(), spineLevel.indices.size());
+		//so are the rings the spine was left standing on
+		auto renumberRing = [&](LFooting& footing) {
+			if (footing.rings[l] != LFooting::NoRing) {
+				footing.rings[l] = renumber(footing.rings[l]);
+			}
+		};
+		renumberRing(turtle.footing);
+		for (LFooting& saved : turtle.savedFootings) {
+			renumberRing(saved);
+		}
+	}
+	spine.Return(arena.buffers[1]);
+	for (size_t k = 0; k < traced.size(); ++k) {
+		traced[k].Return(arena.buffers[k + 2]);
+	}
+}
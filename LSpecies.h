@@ -1,25 +1,315 @@
 #pragma once
 #include <string>
-#include<functional>
+#include <cstdint>
 #include <vector>
+#include <map>
+#include <ostream>
+#include <memory>
+#include <mutex>
 #include "LState.h"
+#include "LString.h"
+#include "LBracketIndex.h"
+#include "LProduction.h"
+#include "LBytecode.h"
+#include "LScan.h"
+#include "LDerivation.h"
+#include "LRing.h"
 #include "Mesh.h"
+#include "InstancedMesh.h"
+#include "SegmentInstance.h"
+#include "LeafInstance.h"
+#include "LBranchBounds.h"
+#include "LTurtleProgram.h"
+#include "LBuildArena.h"
 
 class LSpecies
 {
+public:
+	// A level of detail Build can draw: branches with sides sides, leaving out every segment and tip
+	// thinner than minThickness
+	struct Detail {
+		unsigned int sides;
+		float minThickness;
+	};
+	// Where Build puts the leaves ('L', or L(size)) it comes across: an instance per leaf, all drawn
+	// with the same card instead of each adding triangles of its own
+	struct Foliage {
+		Mesh* mesh;            // the card every leaf is drawn with, e.g. from BuildLeafMesh; shared, not owned
+		InstancedMesh* leaves; // set by Build, nullptr if the tree has no leaves
+	};
+
 private:
-	std::function<std::string(std::string)> iterator;
-	std::string axiom;
+	// One way of rewriting a symbol: a slice of successors, the bytecode computing its parameters,
+	// and when it's chosen
+	struct Alternative {
+		unsigned int start;
+		unsigned int length;
+		uint32_t threshold;         // hash value below which it's picked, for unconditional symbols
+		float weight;
+		unsigned int conditionStart; // slice of bytecode, empty when unconditional
+		unsigned int conditionLength;
+		unsigned int argumentStart;  // slice of bytecode emitting the successor's parameters
+		unsigned int argumentLength;
+		unsigned int parameterCount;
+		char leftContext;            // module required before/after the predecessor, or 0 for any
+		char rightContext;
+	};
+	// Productions compiled into a lookup table indexed by symbol.  The first 256 alternatives are
+	// the identity rewrite of each symbol, which is also the only candidate for symbols without a
+	// production, so Grow never has to branch on whether a symbol is rewritten.
+	std::string successors;
+	std::vector<Alternative> alternatives;
+	std::vector<LInstruction> bytecode;
+	unsigned int alternativeStart[256];
+	unsigned int alternativeCount[256];
+	bool conditional[256];   // some alternative for the symbol has a condition or context to check
+	uint8_t arity[256];
+	bool parametric;         // whether any symbol takes parameters
+	bool contextSensitive;   // whether any production has a context, so Grow needs an LBracketIndex
+	// Glyphs that have a production.  When there are few enough of them and no parameters to carry,
+	// Grow scans past runs of everything else in bulk instead of selecting an identity rewrite per module.
+	LGlyphSet rewrittenGlyphs;
+	bool scanRewrites;
+	bool deterministic;      // each rewritten glyph has a single unconditional alternative, so output length is a count
+	unsigned int growThreads;
+	size_t minModulesPerThread;
+	unsigned int buildThreads;
+	size_t minModulesPerBranch; // smallest branch Build hands to another thread
+	bool buildStreams;          // Build's meshes also keep their vertices as VertexStreams
+	// Every iteration grown so far for growCacheSeed, so Grow(n + 1) only has to rewrite Grow(n)
+	std::map<int, LString> growCache;
+	uint32_t growCacheSeed;
+	std::string growCacheDirectory; // where grown strings are also kept between runs, or empty
+	uint64_t sourceHash;            // of the productions and axiom, naming the files in growCacheDirectory
+	// How many of each glyph every glyph can turn into in one iteration, the most over its alternatives,
+	// so string sizes can be bounded before growing them.  Only glyphs that can occur are indexed.
+	std::vector<unsigned char> growthGlyphs;
+	std::vector<uint32_t> growthMatrix; // growthGlyphs.size() squared, row per predecessor
+	bool growthExact;       // no glyph has a choice of successors, so the bound is the size
+	uint64_t growBudget;    // bytes a grown string may take, or 0 for no limit
+	struct GrowthStep {
+		uint64_t modules;
+		uint64_t parameters;
+	};
+	// What the turtle has drawn so far at one level of detail
+	struct Level {
+		LRing ring;
+		float minThickness;
+		std::vector<Vertex> vertices;
+		std::vector<unsigned int> indices;
+		Level(const LRing& ring, float minThickness) : ring(ring), minThickness(minThickness) {};
+	};
+	// How much tracing a string draws, counted before tracing it so the turtle's buffers are reserved once
+	struct TurtleCounts {
+		size_t segments;
+		size_t tips;
+		size_t leaves;
+		size_t branches;
+		size_t depth;    // most branches open at once
+	};
+	// The turtle partway through a string: where it is, the states it saved at each open '[' (and the
+	// footings it saved at those opened standing on a segment), and
+	// what it has drawn at up to LFooting::MaxDetails levels of detail at once, and as instances, leaves
+	// and bounds if asked
+	struct Turtle {
+		LState state;
+		std::vector<LState> savedStates;
+		LFooting footing;
+		std::vector<LFooting> savedFootings;
+		std::vector<Level> levels;
+		bool instanced;
+		std::vector<SegmentInstance> instances;
+		bool recordLeaves;
+		std::vector<LeafInstance> leaves;
+		bool recordBounds;
+		LBranchBounds::Recording bounds;
+		Turtle(const LState& state, const std::vector<Detail>& details, bool instanced = false, bool recordLeaves = false, bool recordBounds = false);
+		Turtle(const LState& state, const Turtle& like); //same levels, nothing drawn
+		void Reserve(const TurtleCounts& counts); //room to draw counts more of everything it records
+		// Borrow swaps in arena's buffers, emptied, before anything is drawn; Return hands them back,
+		// along with whatever capacity drawing added
+		void Borrow(LBuildArena::Buffers& arena);
+		void Return(LBuildArena::Buffers& arena);
+	};
+	LBuildArena buildArena;       //for builds that aren't given one, one at a time
+	std::mutex buildArenaMutex;   //held by the build using buildArena
+	// The arena one build draws into: the one it was given, or the species' own if no other build has
+	// it, or else one of its own for just this build, so builds without an arena can still overlap
+	class ArenaLease {
+	private:
+		std::unique_lock<std::mutex> lock;
+		std::unique_ptr<LBuildArena> local;
+		LBuildArena* arena;
+	public:
+		ArenaLease(LSpecies& species, LBuildArena* given);
+		LBuildArena& Arena();
+	};
+	LString axiom;
 	float deltaInclination;
 	float deltaAzimuth;
 	float initialThickness;
 	float thicknessDecay;
 	float initialLimbLength;
 	float limbLengthDecay;
+	// Turns by the species' own angles, worked out once: + and - as quaternions about world z, and the
+	// half angle of < and >, whose axis depends on the branch
+	DirectX::XMFLOAT4 pitchDownRotation;
+	DirectX::XMFLOAT4 pitchUpRotation;
+	float rollHalfSine;
+	float rollHalfCosine;
+
+	void CompileProductions(const std::vector<LProduction>& productions, const std::string& axiomText);
+	bool CompileModules(const std::string& text, const std::vector<std::string>& formals, int* declaredArity, std::string& glyphs, unsigned int& parameterCount, std::string& error);
+	const float* GatherActuals(const Alternative& alternative, char symbol, const float* own, const LString* input, const LBracketIndex* index, size_t position, float* scratch, unsigned int& count) const;
+	bool Applies(const Alternative& alternative, char symbol, const float* own, const LString* input, const LBracketIndex* index, size_t position) const;
+	// Context is only checked when the species is context-sensitive, in which case input and index must be given
+	const Alternative& SelectAlternative(char symbol, const float* own, const LString* input, const LBracketIndex* index, uint64_t position, uint32_t seed, uint32_t iteration) const;
+	void CountRewrite(const LString& input, const LBracketIndex* index, size_t begin, size_t end, size_t parameterBegin, uint32_t seed, uint32_t iteration, size_t& length, size_t& parameterLength) const;
+	void CompileScan(); //rewrittenGlyphs, scanRewrites and deterministic, from the tables
+	// Whether tables read from a compiled pack are safe to grow with, working out parametric,
+	// contextSensitive, conditional and what CompileScan does from them along the way
+	bool CheckCompiled();
+	void CompileGrowth();
+	void CompileTurns();
+	void StartGrowth(std::vector<uint64_t>& counts) const; //the axiom's count of each of growthGlyphs
+	// Advances counts of growthGlyphs by one iteration, using next as scratch; false if nothing changed
+	bool StepGrowth(std::vector<uint64_t>& counts, std::vector<uint64_t>& next) const;
+	GrowthStep CountGrowth(const std::vector<uint64_t>& counts) const;
+	// The bound after iterations, clamped to MaxIterations.  largest, if given, gets the most of each over
+	// every iteration, axiom included; glyphCounts gets the count of each of growthGlyphs at the last one.
+	GrowthStep PredictGrowth(int iterations, GrowthStep* largest = nullptr, std::vector<uint64_t>* glyphCounts = nullptr) const;
+	static int ClampIterations(int iterations); //to [0, MaxIterations], warning if it had to
+	// Clamps iterations, then stops at the last one whose strings fit growBudget while it's grown: every
+	// iteration up to it if they're cached, or two buffers as big as the largest of them if not
+	int CapIterations(int iterations, bool cached) const;
+	// Grow, for iterations that have already been through CapIterations, so its warning is printed once
+	const LString& GrowCapped(int iterations, uint32_t seed);
+	void GrowCapped(int iterations, uint32_t seed, LString& result, LString& scratch) const;
+	void Rewrite(const LString& input, uint32_t seed, uint32_t iteration, LString& output) const;
+	bool IsGrown(int iterations, uint32_t seed) const;
+	std::string GrowCachePath(int iterations, uint32_t seed) const;
+	bool LoadGrown(const std::string& path, LString& grown) const;
+	void SaveGrown(const std::string& path, const LString& grown) const;
+	void WriteRewrite(const LString& input, const LBracketIndex* index, size_t begin, size_t end, size_t parameterBegin, uint32_t seed, uint32_t iteration, char* out, float* outParameters) const;
+	bool IsIdentity(const Alternative& alternative) const;
+	LState InitialState() const;
+	template <class ModuleSource>
+	void Trace(ModuleSource& modules, Turtle& turtle) const;
+	void Trace(const LTurtleProgram& program, Turtle& turtle) const; //replays what Compile made
+	template <class ModuleSource>
+	void CompileTurtle(ModuleSource& modules, LTurtleProgram& program) const;
+	// What the turtle does at each module, whether traced from a string or replayed
+	static void DrawSegment(Turtle& turtle, float length, float thickness);
+	static void DrawTip(Turtle& turtle, float length, float thickness);
+	static void OpenBranch(Turtle& turtle);
+	static void CloseBranch(Turtle& turtle);
+	static void AddLeaf(Turtle& turtle, float size);
+	template <class ModuleSource>
+	std::vector<Mesh*> Interpret(ModuleSource& modules, const TurtleCounts* counts, const std::vector<Detail>& details, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, Foliage* foliage, LBranchBounds* bounds, LBuildArena& arena) const;
+	void TraceParallel(const LString& rule, Turtle& turtle, LBuildArena& arena) const;
+	template <class ModuleSource>
+	InstancedMesh* InterpretInstanced(ModuleSource& modules, const TurtleCounts* counts, Mesh* segmentMesh, Microsoft::WRL::ComPtr<ID3D11Device> device, Foliage* foliage, LBranchBounds* bounds, LBuildArena& arena) const;
+	// What tracing symbols draws, counted in several quick passes over them (one per drawing glyph,
+	// then one jumping between brackets) rather than the one walk tracing makes.  Streamed strings
+	// can't be counted ahead, but when growth is exact PredictTurtle works it out from the productions.
+	// Interpret's counts are nullptr if neither applies.
+	static void CountTurtle(const char* symbols, size_t length, TurtleCounts& counts);
+	bool PredictTurtle(int iterations, TurtleCounts& counts) const; //false unless IsSizeExact
+	static InstancedMesh* CreateInstances(Turtle& turtle, Mesh* segmentMesh, Microsoft::WRL::ComPtr<ID3D11Device> device);
+	// Hands the leaves and bounds the turtle recorded to whichever of foliage and bounds were given
+	static void CreateRecorded(Turtle& turtle, Foliage* foliage, LBranchBounds* bounds, Microsoft::WRL::ComPtr<ID3D11Device> device);
+	std::vector<Mesh*> CreateMeshes(Turtle& turtle, size_t detailCount, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context) const;
+
+	// Compiled tables in the form LSpeciesLibrary stores them: the productions, bytecode and arities
+	// are copied as they are, and what's derived from them is worked out again on reading
+	LSpecies();
+	void WriteCompiled(std::ostream& out) const;
+	static LSpecies* ReadCompiled(const char*& cursor, const char* end); //nullptr if malformed
+
+	friend class LExpander;
+	friend class LDerivation;
+	friend class LSpeciesLibrary;
 
 public: 
-	LSpecies(std::function<std::string(std::string)> iterator, std::string axiom, float deltaInclination, float deltaAzimuth, float initialThickness, float thicknessDecay, float initialLimbLength, float limbLengthDecay);
-	std::string Grow(int iterations);
-	Mesh* Build(const std::string& rule, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context);
+	LSpecies(const std::vector<LProduction>& productions, std::string axiom, float deltaInclination, float deltaAzimuth, float initialThickness, float thicknessDecay, float initialLimbLength, float limbLengthDecay);
+	// Grow splits each iteration across up to threads threads once the string is long enough to give
+	// each of them minModulesPerThread modules; below that it stays on the calling thread.
+	// The result is identical either way.  Defaults to every hardware thread.
+	void SetGrowThreads(unsigned int threads, size_t minModulesPerThread = 1 << 16);
+	unsigned int GetGrowThreads() const;
+	size_t GetMinModulesPerThread() const;
+	// Build(rule) traces branches of at least minModulesPerBranch modules on up to threads threads,
+	// once the string has enough of them; the mesh is identical either way.  Defaults to every hardware thread.
+	void SetBuildThreads(unsigned int threads, size_t minModulesPerBranch = 1 << 12);
+	// Whether the meshes Build creates keep a CPU copy of their vertices split by attribute, for passes
+	// like bounds, raycasts and culling that only read positions.  Off by default.
+	void SetBuildStreams(bool keep);
+	// A Build that isn't given an LBuildArena draws into one the species keeps for the next build, so
+	// building many trees allocates about as much as the largest of them once.  This frees it.  A
+	// build that finds another already using it draws into a fresh arena of its own instead, so
+	// builds can overlap either way; threads building trees concurrently can pass an arena each to
+	// keep their capacity too.
+	void ClearBuildArena();
+	// Grows from the furthest iteration already cached for seed.  The result stays valid until the
+	// seed changes or the cache is cleared.
+	const LString& Grow(int iterations, uint32_t seed = 0);
+	// Grow and Build stop at this many iterations, with a warning, however many they're asked for.
+	// Context-sensitive species also stop before growing from a string too long for LBracketIndex.
+	static const int MaxIterations = 256;
+	// Upper bounds on the modules, and the bytes of LString, Grow(iterations) produces, computed
+	// without growing anything.  They're exact if IsSizeExact, i.e. no glyph has a choice of successors.
+	// Iterations past MaxIterations are predicted as MaxIterations, as that's where Grow stops.
+	uint64_t PredictSize(int iterations) const;
+	uint64_t PredictBytes(int iterations) const;
+	bool IsSizeExact() const;
+	// Grow and Build stop early, with a warning, at the last iteration whose predicted bytes fit.
+	// What counts is everything held while growing it: Grow caches every iteration on the way, so their
+	// sum, while builds that grow into buffers of their own hold two.  0, the default, means no limit.
+	void SetGrowBudget(uint64_t bytes);
+	// Opts in to saving what Grow produces under directory, which must exist, and reusing it in
+	// later runs.  Files are named by a hash of the productions, the axiom, the seed and the iteration count.
+	void SetGrowCacheDirectory(const std::string& directory);
+	void ClearGrowCache(); //frees the in-memory cache; files are left alone
+	void Grow(int iterations, uint32_t seed, LString& result, LString& scratch) const; //thread-safe, grows into caller-owned buffers
+	// Grows into a derivation that shares identical subtrees instead of spelling them out.  Returns
+	// false for context-sensitive species, which have to be grown as a string.
+	bool Grow(int iterations, uint32_t seed, LDerivation& result) const;
+	Mesh* Build(const LString& rule, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context);
+	// Builds only the branches nested at most maxBranchDepth deep, jumping straight past deeper ones.
+	// brackets must have been built from rule, with BuildBrackets or Build.  Like every Build, gives
+	// nullptr if nothing is left to draw, or if rule is too long to index.  Given arena, these two draw into it as the overloads below do.
+	Mesh* Build(const LString& rule, const LBracketIndex& brackets, unsigned int maxBranchDepth, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, LBuildArena* arena = nullptr);
+	Mesh* Build(const LDerivation& derivation, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, LBuildArena* arena = nullptr);
+	// Grows and builds in one go, streaming modules to the turtle as they're derived instead of
+	// materializing the grown string, so memory is proportional to the iteration count rather than
+	// the size of the tree.  Context-sensitive species need their neighbors, so they're grown first.
+	Mesh* Build(int iterations, uint32_t seed, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context);
+	// Build a mesh per level of detail, in the same order, from a single walk of the turtle.  Up to
+	// LFooting::MaxDetails levels can be built at once; a level with nothing thick enough to draw gets nullptr.
+	// The overloads above draw one level of 8 sides, leaving nothing out, and no leaves.
+	// Leaves are only kept when foliage is given, in which case its leaves are set.  Given bounds, the
+	// same walk also boxes every segment and tip, whatever its level of detail, into bounds' branches.
+	// Given arena, the walk draws into that rather than the species' own, so any Build can run on
+	// several threads at once.
+	std::vector<Mesh*> Build(const LString& rule, const std::vector<Detail>& details, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, Foliage* foliage = nullptr, LBranchBounds* bounds = nullptr, LBuildArena* arena = nullptr);
+	std::vector<Mesh*> Build(int iterations, uint32_t seed, const std::vector<Detail>& details, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, Foliage* foliage = nullptr, LBranchBounds* bounds = nullptr, LBuildArena* arena = nullptr);
+	// Builds the tree as a SegmentInstance per segment and tip, drawn with segmentMesh, instead of
+	// spelling out every ring: 40 bytes a segment rather than a cylinder's worth of vertices and indices.
+	// segmentMesh is shared, not owned; nullptr if nothing is drawn.
+	InstancedMesh* BuildInstanced(const LString& rule, Mesh* segmentMesh, Microsoft::WRL::ComPtr<ID3D11Device> device, Foliage* foliage = nullptr, LBranchBounds* bounds = nullptr, LBuildArena* arena = nullptr);
+	InstancedMesh* BuildInstanced(int iterations, uint32_t seed, Mesh* segmentMesh, Microsoft::WRL::ComPtr<ID3D11Device> device, Foliage* foliage = nullptr, LBranchBounds* bounds = nullptr, LBuildArena* arena = nullptr);
+	// Compiles the turtle's walk of rule, or of the string Grow(iterations, seed) gives, streamed if it
+	// can be, into program.  Building from program draws the same tree as building from the string,
+	// except that folding turns together can round differently in the last bit.
+	void Compile(const LString& rule, LTurtleProgram& program) const;
+	void Compile(int iterations, uint32_t seed, LTurtleProgram& program) const;
+	// Replays program on the calling thread, reserving exactly what it records
+	std::vector<Mesh*> Build(const LTurtleProgram& program, const std::vector<Detail>& details, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, Foliage* foliage = nullptr, LBranchBounds* bounds = nullptr, LBuildArena* arena = nullptr);
+	InstancedMesh* BuildInstanced(const LTurtleProgram& program, Mesh* segmentMesh, Microsoft::WRL::ComPtr<ID3D11Device> device, Foliage* foliage = nullptr, LBranchBounds* bounds = nullptr, LBuildArena* arena = nullptr);
+	// The unit cylinder BuildInstanced's segments are drawn with, any species' will do
+	static Mesh* BuildSegmentMesh(unsigned int sides, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context);
+	// A leaf card for Foliage: a unit square, textured on both sides, from its stalk at the origin out
+	// along z, facing y
+	static Mesh* BuildLeafMesh(Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context);
 };
 
@@ -0,0 +1,330 @@
+#include "LSpeciesLibrary.h"
+#include "LMappedFile.h"
+#include "LHash.h"
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+
+// Layout of a compiled pack: this header, then per species its name's length, its name and its tables
+struct LPackHeader {
+	char magic[4];
+	uint32_t version;    // bumped whenever the layout of the tables changes
+	uint64_t sourceHash;
+	uint32_t count;
+	uint32_t reserved;
+};
+static const char lPackMagic[4] = { 'L', 'S', 'P', 'C' };
+static const uint32_t lPackVersion = 2;
+
+LSpeciesLibrary::LSpeciesLibrary() : sourceHash(0)
+{
+}
+
+LSpeciesLibrary::~LSpeciesLibrary()
+{
+	Clear();
+}
+
+void LSpeciesLibrary::Clear()
+{
+	for (LSpecies* s : species) {
+		delete s;
+	}
+	names.clear();
+	species.clear();
+	sourceHash = 0;
+}
+
+void LSpeciesLibrary::Add(const std::string& name, LSpecies* added)
+{
+	for (size_t i = 0; i < names.size(); ++i) {
+		if (names[i] == name) {
+			delete species[i];
+			species[i] = added;
+			return;
+		}
+	}
+	names.push_back(name);
+	species.push_back(added);
+}
+
+LSpecies* LSpeciesLibrary::Find(const std::string& name) const
+{
+	for (size_t i = 0; i < names.size(); ++i) {
+		if (names[i] == name) {
+			return species[i];
+		}
+	}
+	return nullptr;
+}
+
+size_t LSpeciesLibrary::Count() const
+{
+	return species.size();
+}
+
+static std::string Trim(const std::string& text)
+{
+	const size_t first = text.find_first_not_of(" \t");
+	if (first == std::string::npos) {
+		return std::string();
+	}
+	return text.substr(first, text.find_last_not_of(" \t") - first + 1);
+}
+
+// Position of separator outside any parentheses, or npos.  When spaced is set it has to have
+// whitespace on both sides, which tells a context's < and > apart from the turn glyphs.
+static size_t FindSeparator(const std::string& text, char separator, bool spaced)
+{
+	int depth = 0;
+	for (size_t i = 0; i < text.size(); ++i) {
+		if (text[i] == '(') {
+			++depth;
+		}
+		else if (text[i] == ')') {
+			--depth;
+		}
+		else if (depth == 0 && text[i] == separator) {
+			if (!spaced || (i > 0 && i + 1 < text.size() && isspace((unsigned char)text[i - 1]) && isspace((unsigned char)text[i + 1]))) {
+				return i;
+			}
+		}
+	}
+	return std::string::npos;
+}
+
+// Parses "left < predecessor > right : condition ->(weight) successor", all but the predecessor and successor optional
+static bool ParseProduction(const std::string& line, std::vector<LProduction>& productions, std::string& error)
+{
+	const size_t arrow = line.find("->");
+	std::string lhs = line.substr(0, arrow);
+	std::string successor = line.substr(arrow + 2);
+	float weight = 1.f;
+	const size_t open = successor.find_first_not_of(" \t");
+	if (open != std::string::npos && successor[open] == '(') {
+		const size_t close = successor.find(')', open);
+		char* parsed = nullptr;
+		if (close != std::string::npos) {
+			weight = strtof(successor.c_str() + open + 1, &parsed);
+		}
+		if (close == std::string::npos || parsed != successor.c_str() + close) {
+			error = "malformed weight";
+			return false;
+		}
+		successor = successor.substr(close + 1);
+	}
+	std::string condition;
+	const size_t colon = FindSeparator(lhs, ':', false);
+	if (colon != std::string::npos) {
+		condition = lhs.substr(colon + 1);
+		lhs = lhs.substr(0, colon);
+	}
+	std::string leftContext;
+	std::string rightContext;
+	const size_t less = FindSeparator(lhs, '<', true);
+	if (less != std::string::npos) {
+		leftContext = lhs.substr(0, less);
+		lhs = lhs.substr(less + 1);
+	}
+	const size_t greater = FindSeparator(lhs, '>', true);
+	if (greater != std::string::npos) {
+		rightContext = lhs.substr(greater + 1);
+		lhs = lhs.substr(0, greater);
+	}
+	if (Trim(lhs).empty()) {
+		error = "missing predecessor";
+		return false;
+	}
+	productions.push_back(LProduction(Trim(leftContext), Trim(lhs), Trim(rightContext), Trim(condition), Trim(successor), weight));
+	return true;
+}
+
+bool LSpeciesLibrary::LoadText(const std::string& path)
+{
+	LMappedFile file;
+	if (!file.Open(path)) {
+		return false;
+	}
+	Clear();
+	sourceHash = LHashBytes(LHashBytesBasis, file.Data(), file.Size());
+	const float degrees = 3.14159265f / 180.f;
+	//settings of the species being read, defaulting to a plain tree
+	bool started = false;
+	std::string name;
+	std::string axiom;
+	std::vector<LProduction> productions;
+	float inclination = 30;
+	float azimuth = 120;
+	float thickness = 0.3f;
+	float thicknessDecay = 0.7f;
+	float length = 1;
+	float lengthDecay = 0.8f;
+	auto finish = [&]() {
+		if (started) {
+			Add(name, new LSpecies(productions, axiom, inclination * degrees, azimuth * degrees, thickness, thicknessDecay, length, lengthDecay));
+		}
+	};
+	const char* cursor = file.Data();
+	const char* end = cursor + file.Size();
+	for (int lineNumber = 1; cursor < end; ++lineNumber) {
+		const char* lineEnd = (const char*)memchr(cursor, '\n', end - cursor);
+		if (lineEnd == nullptr) {
+			lineEnd = end;
+		}
+		const std::string line = Trim(std::string(cursor, lineEnd - (lineEnd > cursor && lineEnd[-1] == '\r' ? 1 : 0)));
+		cursor = lineEnd + 1;
+		if (line.empty() || line.compare(0, 2, "//") == 0) {
+			continue;
+		}
+		std::string error;
+		//settings are told apart by their first word, as an axiom can hold "->" as a turn and a roll
+		std::istringstream in(line);
+		std::string keyword;
+		in >> keyword;
+		const bool setting = keyword == "species" || keyword == "axiom" || keyword == "inclination" || keyword == "azimuth" || keyword == "thickness" || keyword == "length";
+		if (!setting && line.find("->") != std::string::npos) {
+			if (!started) {
+				error = "production before any species";
+			}
+			else {
+				ParseProduction(line, productions, error);
+			}
+		}
+		else {
+			if (keyword == "species") {
+				finish();
+				started = true;
+				in >> name;
+				axiom.clear();
+				productions.clear();
+				inclination = 30;
+				azimuth = 120;
+				thickness = 0.3f;
+				thicknessDecay = 0.7f;
+				length = 1;
+				lengthDecay = 0.8f;
+			}
+			else if (!started) {
+				error = "setting before any species";
+			}
+			else if (keyword == "axiom") {
+				axiom = Trim(line.substr(keyword.size()));
+			}
+			else if (keyword == "inclination") {
+				in >> inclination;
+			}
+			else if (keyword == "azimuth") {
+				in >> azimuth;
+			}
+			else if (keyword == "thickness") {
+				in >> thickness >> thicknessDecay;
+			}
+			else if (keyword == "length") {
+				in >> length >> lengthDecay;
+			}
+			else {
+				error = "unknown setting '" + keyword + "'";
+			}
+			if (error.empty() && in.fail()) {
+				error = "expected a value after '" + keyword + "'";
+			}
+		}
+		if (!error.empty()) {
+			printf("LSpeciesLibrary: %s:%d: %s\n", path.c_str(), lineNumber, error.c_str());
+		}
+	}
+	finish();
+	return true;
+}
+
+bool LSpeciesLibrary::SaveCompiled(const std::string& path) const
+{
+	std::ofstream out(path, std::ios::binary);
+	if (!out.is_open()) {
+		printf("LSpeciesLibrary: couldn't write '%s'\n", path.c_str());
+		return false;
+	}
+	LPackHeader header = {};
+	memcpy(header.magic, lPackMagic, sizeof(lPackMagic));
+	header.version = lPackVersion;
+	header.sourceHash = sourceHash;
+	header.count = (uint32_t)species.size();
+	out.write((const char*)&header, sizeof(header));
+	for (size_t i = 0; i < species.size(); ++i) {
+		const uint32_t nameLength = (uint32_t)names[i].size();
+		out.write((const char*)&nameLength, sizeof(nameLength));
+		out.write(names[i].data(), nameLength);
+		species[i]->WriteCompiled(out);
+	}
+	if (!out) {
+		printf("LSpeciesLibrary: couldn't write '%s'\n", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool LSpeciesLibrary::LoadCompiled(const std::string& path)
+{
+	LMappedFile file;
+	if (!file.Open(path)) {
+		return false;
+	}
+	Clear();
+	const char* cursor = file.Data();
+	const char* end = cursor + file.Size();
+	LPackHeader header;
+	if (file.Size() < sizeof(header)) {
+		printf("LSpeciesLibrary: '%s' isn't a compiled species pack\n", path.c_str());
+		return false;
+	}
+	memcpy(&header, cursor, sizeof(header));
+	cursor += sizeof(header);
+	if (memcmp(header.magic, lPackMagic, sizeof(lPackMagic)) != 0 || header.version != lPackVersion) {
+		printf("LSpeciesLibrary: '%s' isn't a compiled species pack of this version\n", path.c_str());
+		return false;
+	}
+	for (uint32_t i = 0; i < header.count; ++i) {
+		uint32_t nameLength;
+		LSpecies* loaded = nullptr;
+		if ((size_t)(end - cursor) >= sizeof(nameLength)) {
+			memcpy(&nameLength, cursor, sizeof(nameLength));
+			cursor += sizeof(nameLength);
+			if ((size_t)(end - cursor) >= nameLength) {
+				const std::string name(cursor, nameLength);
+				cursor += nameLength;
+				loaded = LSpecies::ReadCompiled(cursor, end);
+				if (loaded != nullptr) {
+					Add(name, loaded);
+				}
+			}
+		}
+		if (loaded == nullptr) {
+			printf("LSpeciesLibrary: '%s' is corrupt\n", path.c_str());
+			Clear();
+			return false;
+		}
+	}
+	sourceHash = header.sourceHash;
+	return true;
+}
+
+bool LSpeciesLibrary::Load(const std::string& sourcePath, const std::string& compiledPath)
+{
+	LMappedFile source;
+	if (!source.Open(sourcePath)) {
+		//shipping just the pack is fine
+		return LoadCompiled(compiledPath);
+	}
+	const uint64_t currentHash = LHashBytes(LHashBytesBasis, source.Data(), source.Size());
+	if (LoadCompiled(compiledPath) && sourceHash == currentHash) {
+		return true;
+	}
+	if (!LoadText(sourcePath)) {
+		return false;
+	}
+	SaveCompiled(compiledPath);
+	return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "LSpecies.h"
+
+// A named collection of species, read from .lsys grammar files or from a compiled pack.
+//
+// A .lsys file lists species one setting or production per line; lines starting with // are comments.
+// A line is a setting if it starts with one of the words below, so an axiom may hold "->", and
+// otherwise a production if it holds "->".
+//   species tree1                  starts a new species; everything below belongs to it
+//   axiom X
+//   inclination 30                 degrees turned by + and -
+//   azimuth 120                    degrees rolled by < and >
+//   thickness 0.3 0.7              initial thickness, and the factor # multiplies it by
+//   length 1 0.8                   initial segment length, and the factor $ multiplies it by
+//   X ->(3) F[-#$[FX]<[FX]<[FX]]   a production, with an optional weight in brackets
+//   B < A(l) > C : l > 1 -> F(l)   contexts are set off by spaced < and >, a condition by :
+//
+// A compiled pack holds the species' production tables, bytecode and arities exactly as LSpecies
+// uses them, so loading one copies them from a memory-mapped file with no parsing.  What's derived
+// from those tables (the flags, the glyphs Grow scans for, the growth matrix and the turns) is
+// checked and worked out again, which takes a pass over each table.
+class LSpeciesLibrary
+{
+private:
+	std::vector<std::string> names;
+	std::vector<LSpecies*> species;
+	uint64_t sourceHash;   // of the .lsys text the species were parsed from
+
+	void Add(const std::string& name, LSpecies* added);
+
+public:
+	LSpeciesLibrary();
+	~LSpeciesLibrary();
+	LSpeciesLibrary(const LSpeciesLibrary&) = delete;
+	LSpeciesLibrary& operator=(const LSpeciesLibrary&) = delete;
+
+	// Each returns false if the file couldn't be read.  Malformed lines of a .lsys file are reported
+	// and skipped; a malformed pack is rejected whole.
+	bool LoadText(const std::string& path);
+	bool LoadCompiled(const std::string& path);
+	bool SaveCompiled(const std::string& path) const;
+	// Loads compiledPath if it was compiled from sourcePath as it is now; otherwise parses sourcePath
+	// and recompiles compiledPath from it.  Checking costs one read of the source, not a parse.
+	bool Load(const std::string& sourcePath, const std::string& compiledPath);
+	void Clear();
+
+	LSpecies* Find(const std::string& name) const; //nullptr if there's no such species
+	size_t Count() const;
+};
@@ -1,12 +1,40 @@
 #pragma once
 
 #include <DirectXMath.h>
+#include <cstddef>
+#include <cstdint>
 
+// What the turtle saves at every '[': 36 bytes
 struct LState {
 	DirectX::XMFLOAT3 position;
-	DirectX::XMFLOAT4X4 direction;
+	// Unit quaternion turning the turtle's own axes (right x, up y, forward z) into world space;
+	// 16 bytes to save at every '[' instead of a whole matrix
+	DirectX::XMFLOAT4 orientation;
 	float thickness;
 	float length;
-	LState(DirectX::XMFLOAT3 position, DirectX::XMFLOAT4X4 direction, float thickness, float length) :
-		position(position), direction(direction), thickness(thickness), length(length) {};
-};
\ No newline at end of file
+	LState(DirectX::XMFLOAT3 position, DirectX::XMFLOAT4 orientation, float thickness, float length) :
+		position(position), orientation(orientation), thickness(thickness), length(length) {};
+};
+
+// The top of the segment the turtle just drew, which the next one starts from if it carries straight
+// on at the same radius.  Kept apart from LState and only saved at a '[' the turtle opens while
+// standing on a segment, so most branches don't copy it.
+struct LFooting {
+	static const unsigned int MaxDetails = 4;
+	static const uint32_t NoRing = UINT32_MAX;
+	// First vertex of the top ring at each level of detail being built; NoRing after a turn, a branch,
+	// a tip, or a segment too thin for the level
+	uint32_t rings[MaxDetails];
+	float radius;
+	bool onSegment; //standing on the top of a segment, whether or not any level drew it
+	size_t depth;   //once saved, how many states were saved with it
+	LFooting() : radius(0), onSegment(false), depth(0) {
+		Clear();
+	};
+	void Clear() {
+		for (unsigned int level = 0; level < MaxDetails; ++level) {
+			rings[level] = NoRing;
+		}
+		onSegment = false;
+	}
+};
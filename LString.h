@@ -0,0 +1,15 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// A string of modules.  Each module is one glyph in symbols; the parameters of all modules are
+// packed in order into a parallel float array, each module taking as many as its symbol's arity.
+struct LString {
+	std::string symbols;
+	std::vector<float> parameters;
+
+	void swap(LString& other) {
+		symbols.swap(other.symbols);
+		parameters.swap(other.parameters);
+	}
+};
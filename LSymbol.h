@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include "LScan.h"
+
+// The turtle commands a grown string can contain.  Strings keep one byte per symbol (the glyph
+// used in the grammar), and every glyph is classified into one of these through a table built at
+// compile time, so grammar-only symbols like 'A' cost nothing to interpret.
+enum class LSymbol : uint8_t {
+	Inert = 0,      // no effect on the turtle; only meaningful to the productions
+	Segment,        // F
+	Tip,            // X
+	PitchDown,      // +
+	PitchUp,        // -
+	RollRight,      // >
+	RollLeft,       // <
+	Push,           // [
+	Pop,            // ]
+	ThicknessDecay, // #
+	LengthDecay,    // $
+	Leaf,           // L
+	Count
+};
+
+constexpr LSymbol ClassifyGlyph(char glyph) {
+	return glyph == 'F' ? LSymbol::Segment
+		: glyph == 'X' ? LSymbol::Tip
+		: glyph == '+' ? LSymbol::PitchDown
+		: glyph == '-' ? LSymbol::PitchUp
+		: glyph == '>' ? LSymbol::RollRight
+		: glyph == '<' ? LSymbol::RollLeft
+		: glyph == '[' ? LSymbol::Push
+		: glyph == ']' ? LSymbol::Pop
+		: glyph == '#' ? LSymbol::ThicknessDecay
+		: glyph == '$' ? LSymbol::LengthDecay
+		: glyph == 'L' ? LSymbol::Leaf
+		: LSymbol::Inert;
+}
+
+struct LSymbolTable {
+	LSymbol symbols[256];
+	constexpr LSymbolTable() : symbols() {
+		for (int i = 0; i < 256; ++i) {
+			symbols[i] = ClassifyGlyph((char)i);
+		}
+	}
+};
+
+constexpr LSymbolTable lSymbolTable;
+
+inline LSymbol ToSymbol(char glyph) {
+	return lSymbolTable.symbols[(unsigned char)glyph];
+}
+
+// The glyphs the turtle responds to, for vectorized skipping over everything else
+inline const LGlyphSet& TurtleGlyphs() {
+	static const LGlyphSet glyphs = [] {
+		LGlyphSet set;
+		for (int i = 0; i < 256; ++i) {
+			if (lSymbolTable.symbols[i] != LSymbol::Inert) {
+				set.Add((char)i);
+			}
+		}
+		return set;
+	}();
+	return glyphs;
+}
+
+// Returns the first symbol in [begin, end) that does anything to the turtle, or end
+inline const char* SkipInertSymbols(const char* begin, const char* end) {
+	//turtle symbols usually follow each other directly, so only vector scan once a run of inert ones starts
+	if (begin == end || lSymbolTable.symbols[(unsigned char)*begin] != LSymbol::Inert) {
+		return begin;
+	}
+	return begin + 1 + LFindFirstOf(begin + 1, (size_t)(end - begin - 1), TurtleGlyphs());
+}
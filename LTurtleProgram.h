@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <DirectXMath.h>
+
+// What an op in an LTurtleProgram does: the turtle commands of LSymbol, with + and - compiled
+// into Turn and < and > into Roll
+enum class LTurtleOpcode : uint8_t {
+	Segment,
+	Tip,
+	Turn,           // by a quaternion in world space
+	Roll,           // about the forward axis of the branch the turtle is in
+	Push,
+	Pop,
+	Leaf,
+	ThicknessDecay,
+	LengthDecay
+};
+
+struct LTurtleOp {
+	LTurtleOpcode opcode;
+	uint8_t argumentCount; // own parameters the op uses; the rest are the turtle's or the species' defaults
+	uint32_t operand;      // where those parameters start in arguments, or a turn's entry in rotations
+};
+
+// A grown string compiled for the turtle by LSpecies::Compile: only the modules that move or draw,
+// as ops, with each run of turns folded into one whose rotation was worked out while compiling.
+// Replaying it skips classifying glyphs, stepping over inert modules, and the sines and quaternion
+// products of every turn, so a tree can be rebuilt at other levels of detail, instanced, or with
+// foliage for less than building it from its string.  Only valid for the species that compiled it.
+struct LTurtleProgram {
+	std::vector<LTurtleOp> ops;
+	std::vector<float> arguments;
+	// Turn: the quaternion.  Roll: the sine and cosine of half the angle in x and y, the axis being
+	// known only when it's replayed.
+	std::vector<DirectX::XMFLOAT4> rotations;
+	// Counted while compiling, so replaying can reserve everything it draws
+	size_t segments;
+	size_t tips;
+	size_t leaves;
+	size_t branches;
+	size_t depth; // most branches open at once
+
+	LTurtleProgram() : segments(0), tips(0), leaves(0), branches(0), depth(0) {};
+	void Clear() {
+		ops.clear();
+		arguments.clear();
+		rotations.clear();
+		segments = tips = leaves = branches = depth = 0;
+	}
+};
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <DirectXMath.h>
+
+// --------------------------------------------------------
+// One leaf drawn as an instance of a shared leaf card, a unit
+// square from its stalk at the origin out along z, facing y
+//
+// - Must match the _PER_INSTANCE inputs of
+//   InstancedLeafVertexShader, in size, order and number
+// --------------------------------------------------------
+struct LeafInstance
+{
+	DirectX::XMFLOAT4 Orientation;	// Unit quaternion turning the card's axes into the tree's
+	DirectX::XMFLOAT3 Position;		// Where the stalk meets the branch
+	float Scale;					// Length and width of the leaf
+};
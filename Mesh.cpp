@@ -5,13 +5,15 @@
 
 using namespace DirectX;
 
-Mesh::Mesh(Vertex* vertices, unsigned int numVertices, unsigned int* indices, unsigned int numIndices, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context)
+Mesh::Mesh(Vertex* vertices, unsigned int numVertices, unsigned int* indices, unsigned int numIndices, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, bool keepStreams)
 {
-	init(vertices, numVertices, indices, numIndices, device, context);
+	streams = nullptr;
+	init(vertices, numVertices, indices, numIndices, device, context, keepStreams);
 }
 
-Mesh::Mesh(const char* fileName, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context)
+Mesh::Mesh(const char* fileName, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, bool keepStreams)
 {
+	streams = nullptr;
 	// Author: Chris Cascioli
 // Purpose: Basic .OBJ 3D model loading, supporting positions, uvs and normals
 // 
@@ -226,16 +228,25 @@ Mesh::Mesh(const char* fileName, Microsoft::WRL::ComPtr<ID3D11Device> device, Mi
 	//    an index buffer isn't doing much for us.  We could try to optimize the mesh ourselves
 	//    and detect duplicate vertices, but at that point it would be better to use a more
 	//    sophisticated model loading library like TinyOBJLoader or AssImp (yes, that's its name)
-	init(&verts[0], verts.size(), &indices[0], indices.size(), device, context);
+	init(&verts[0], verts.size(), &indices[0], indices.size(), device, context, keepStreams);
 }
 
-void Mesh::init(Vertex* vertices, unsigned int numVertices, unsigned int* indices, unsigned int numIndices, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context)
+void Mesh::init(Vertex* vertices, unsigned int numVertices, unsigned int* indices, unsigned int numIndices, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, bool keepStreams)
 {
 	this->numIndices = numIndices;
 	this->context = context;
 
 	CalculateTangents(vertices, numVertices, indices, numIndices);
 
+	// Split by attribute after the tangents are in, so the streams match the buffer exactly.
+	// Any from an earlier init describe the old buffer, so they go either way.
+	delete streams;
+	streams = nullptr;
+	if (keepStreams)
+	{
+		streams = new VertexStreams(vertices, numVertices, indices, numIndices);
+	}
+
 	D3D11_BUFFER_DESC vbd = {};
 	vbd.Usage = D3D11_USAGE_IMMUTABLE;
 	vbd.ByteWidth = sizeof(Vertex) * numVertices;
@@ -276,6 +287,7 @@ void Mesh::init(Vertex* vertices, unsigned int numVertices, unsigned int* indice
 
 Mesh::~Mesh()
 {
+	delete streams;
 }
 
 Microsoft::WRL::ComPtr<ID3D11Buffer> Mesh::GetVertexBuffer()
@@ -293,6 +305,11 @@ unsigned int Mesh::GetIndexCount()
 	return numIndices;
 }
 
+const VertexStreams* Mesh::GetStreams()
+{
+	return streams;
+}
+
 void Mesh::Draw()
 {
 	// Set buffers in the input assembler
@@ -318,6 +335,23 @@ void Mesh::Draw()
 		0);				// Offset to add to each index when looking up vertices
 }
 
+void Mesh::DrawInstanced(Microsoft::WRL::ComPtr<ID3D11Buffer> instanceBuffer, unsigned int instanceStride, unsigned int numInstances)
+{
+	// Slot 0 steps once per vertex, slot 1 once per instance
+	ID3D11Buffer* buffers[2] = { vertexBuffer.Get(), instanceBuffer.Get() };
+	UINT strides[2] = { sizeof(Vertex), instanceStride };
+	UINT offsets[2] = { 0, 0 };
+	context->IASetVertexBuffers(0, 2, buffers, strides, offsets);
+	context->IASetIndexBuffer(indexBuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
+
+	context->DrawIndexedInstanced(
+		numIndices,		// Indices per instance
+		numInstances,
+		0,				// Offset to the first index
+		0,				// Offset to add to each index
+		0);				// Offset to the first instance
+}
+
 // --------------------------------------------------------
 // Author: Chris Cascioli
 // Purpose: Calculates the tangents of the vertices in a mesh
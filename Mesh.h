@@ -2,6 +2,7 @@
 #include <d3d11.h>
 #include <wrl/client.h> // Used for ComPtr - a smart pointer for COM objects
 #include "Vertex.h"
+#include "VertexStreams.h"
 
 class Mesh
 {
@@ -10,15 +11,22 @@ private:
 	Microsoft::WRL::ComPtr<ID3D11Buffer> indexBuffer;
 	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context;
 	unsigned int numIndices;
+	VertexStreams* streams; //CPU copy of the vertices split by attribute, if asked for
 	void CalculateTangents(Vertex* verts, int numVerts, unsigned int* indices, int numIndices); //private since it's only used internally
 public:
-	Mesh(Vertex* vertices, unsigned int numVertices, unsigned int* indices, unsigned int numIndices, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context);
-	Mesh(const char* fileName, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context);
-	void init(Vertex* vertices, unsigned int numVertices, unsigned int* indices, unsigned int numIndices, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context);
+	// keepStreams also keeps the vertices, tangents included, and indices on the CPU as VertexStreams
+	Mesh(Vertex* vertices, unsigned int numVertices, unsigned int* indices, unsigned int numIndices, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, bool keepStreams = false);
+	Mesh(const char* fileName, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, bool keepStreams = false);
+	void init(Vertex* vertices, unsigned int numVertices, unsigned int* indices, unsigned int numIndices, Microsoft::WRL::ComPtr<ID3D11Device> device, Microsoft::WRL::ComPtr<ID3D11DeviceContext> context, bool keepStreams = false);
 	~Mesh();
+	Mesh(const Mesh&) = delete; //owns its streams
+	Mesh& operator=(const Mesh&) = delete;
 	Microsoft::WRL::ComPtr<ID3D11Buffer> GetVertexBuffer();
 	Microsoft::WRL::ComPtr<ID3D11Buffer> GetIndexBuffer();
 	unsigned int GetIndexCount();
+	const VertexStreams* GetStreams(); //nullptr unless the last init was asked to keepStreams
 	void Draw();
+	// Draws numInstances copies, with instanceBuffer bound to input slot 1 for per-instance data
+	void DrawInstanced(Microsoft::WRL::ComPtr<ID3D11Buffer> instanceBuffer, unsigned int instanceStride, unsigned int numInstances);
 };
 
@@ -6,6 +6,15 @@ using namespace DirectX;
 MeshEntity::MeshEntity(Mesh* mesh, Material * material)
 {
 	pMesh = mesh;
+	pInstances = nullptr;
+	pMaterial = material;
+	transform = Transform();
+}
+
+MeshEntity::MeshEntity(InstancedMesh* instances, Material* material)
+{
+	pMesh = instances->GetMesh();
+	pInstances = instances;
 	pMaterial = material;
 	transform = Transform();
 }
@@ -15,6 +24,17 @@ Mesh* MeshEntity::GetMesh()
 	return pMesh;
 }
 
+void MeshEntity::SetMesh(Mesh* mesh)
+{
+	pMesh = mesh;
+	pInstances = nullptr;
+}
+
+InstancedMesh* MeshEntity::GetInstances()
+{
+	return pInstances;
+}
+
 Transform* const MeshEntity::GetTransform()
 {
 	return &transform;
@@ -45,5 +65,10 @@ void MeshEntity::Draw(std::shared_ptr<Camera> camera, Microsoft::WRL::ComPtr<ID3
 
 	pMaterial->GetVertexShader()->SetShader();
 	pMaterial->GetPixelShader()->SetShader();
-	pMesh->Draw();
+	if (pInstances != nullptr) {
+		pInstances->Draw();
+	}
+	else {
+		pMesh->Draw();
+	}
 }
@@ -3,17 +3,23 @@
 #include "Transform.h"
 #include "Camera.h"
 #include "Mesh.h"
+#include "InstancedMesh.h"
 #include "Material.h"
 
 class MeshEntity
 {
 private:
 	Mesh * pMesh;
+	InstancedMesh * pInstances; //drawn instead of pMesh when set
 	Material * pMaterial;
 	Transform transform;
 public: 
 	MeshEntity(Mesh * mesh, Material * material);
+	// material's vertex shader has to read the instances' _PER_INSTANCE inputs
+	MeshEntity(InstancedMesh * instances, Material * material);
 	Mesh * GetMesh();
+	void SetMesh(Mesh * mesh); //draws mesh from now on, even if the entity was instanced
+	InstancedMesh * GetInstances(); //nullptr unless the entity draws instances
 	Transform * const GetTransform();
 	Material * GetMaterial();
 	void SetMaterial(Material * material);
@@ -0,0 +1,10 @@
+#ifndef __QUATERNION_INCLUDES__
+#define __QUATERNION_INCLUDES__
+
+// Rotates v by the unit quaternion q, as XMVector3Rotate does
+float3 Rotate(float3 v, float4 q)
+{
+	return v + 2 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+#endif
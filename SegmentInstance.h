@@ -0,0 +1,19 @@
+#pragma once
+
+#include <DirectXMath.h>
+
+// --------------------------------------------------------
+// One branch segment drawn as an instance of a shared unit
+// cylinder: radius 1 around z, from z = 0 to z = 1
+//
+// - Must match the _PER_INSTANCE inputs of
+//   InstancedSegmentVertexShader, in size, order and number
+// --------------------------------------------------------
+struct SegmentInstance
+{
+	DirectX::XMFLOAT4 Orientation;	// Unit quaternion turning the cylinder's axes into the tree's (z along the branch)
+	DirectX::XMFLOAT3 Position;		// Center of the bottom of the segment
+	float Length;
+	float BottomRadius;
+	float TopRadius;				// 0 for the cone capping a tip
+};
@@ -49,6 +49,35 @@ struct VertexShaderInput
 	float2 uv				: TEXCOORD;
 };
 
+// A vertex of the shared unit cylinder, followed by the branch segment it's drawn as
+// - Should match Vertex and then SegmentInstance in our C++ code
+// - The _PER_INSTANCE semantics are read once per instance, from the buffer in slot 1
+struct SegmentVertexShaderInput
+{
+	float3 localPosition	: POSITION;
+	float3 normal			: NORMAL;
+	float3 tangent			: TANGENT;
+	float2 uv				: TEXCOORD;
+	float4 orientation		: ORIENTATION_PER_INSTANCE;
+	float3 segmentPosition	: POSITION_PER_INSTANCE;
+	float length			: LENGTH_PER_INSTANCE;
+	float bottomRadius		: BOTTOM_RADIUS_PER_INSTANCE;
+	float topRadius			: TOP_RADIUS_PER_INSTANCE;
+};
+
+// A vertex of the shared leaf card, followed by the leaf it's drawn as
+// - Should match Vertex and then LeafInstance in our C++ code
+struct LeafVertexShaderInput
+{
+	float3 localPosition	: POSITION;
+	float3 normal			: NORMAL;
+	float3 tangent			: TANGENT;
+	float2 uv				: TEXCOORD;
+	float4 orientation		: ORIENTATION_PER_INSTANCE;
+	float3 leafPosition		: POSITION_PER_INSTANCE;
+	float scale				: SCALE_PER_INSTANCE;
+};
+
 struct Light {
 	int type				: LIGHT_TYPE;
 	float3 direction		: DIRECTION;
@@ -0,0 +1,31 @@
+#include "VertexStreams.h"
+
+using namespace DirectX;
+
+VertexStreams::VertexStreams(const Vertex* vertices, unsigned int numVertices, const unsigned int* indices, unsigned int numIndices) :
+	positions(numVertices), normals(numVertices), tangents(numVertices), uvs(numVertices), indices(indices, indices + numIndices)
+{
+	for (unsigned int i = 0; i < numVertices; ++i) {
+		positions[i] = vertices[i].Position;
+		normals[i] = vertices[i].Normal;
+		tangents[i] = vertices[i].Tangent;
+		uvs[i] = vertices[i].UV;
+	}
+}
+
+bool VertexStreams::Bounds(XMFLOAT3& min, XMFLOAT3& max) const
+{
+	if (positions.empty()) {
+		return false;
+	}
+	XMVECTOR low = XMLoadFloat3(&positions[0]);
+	XMVECTOR high = low;
+	for (const XMFLOAT3& position : positions) {
+		const XMVECTOR p = XMLoadFloat3(&position);
+		low = XMVectorMin(low, p);
+		high = XMVectorMax(high, p);
+	}
+	XMStoreFloat3(&min, low);
+	XMStoreFloat3(&max, high);
+	return true;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <vector>
+#include "Vertex.h"
+
+// --------------------------------------------------------
+// A mesh's vertices with each attribute in an array of its own,
+// kept on the CPU alongside the interleaved vertex buffer.
+//
+// Passes that only need some attributes (bounds, raycasts,
+// culling, depth-only or shadow geometry) stream 12 bytes of
+// position per vertex instead of a whole 44 byte Vertex.
+// --------------------------------------------------------
+struct VertexStreams
+{
+	std::vector<DirectX::XMFLOAT3> positions;
+	std::vector<DirectX::XMFLOAT3> normals;
+	std::vector<DirectX::XMFLOAT3> tangents;
+	std::vector<DirectX::XMFLOAT2> uvs;
+	std::vector<unsigned int> indices; //triangles, as in the index buffer
+
+	VertexStreams() {};
+	VertexStreams(const Vertex* vertices, unsigned int numVertices, const unsigned int* indices, unsigned int numIndices);
+	// Axis-aligned box around every position, reading nothing else.  Returns false, leaving min and
+	// max alone, if there are no vertices.
+	bool Bounds(DirectX::XMFLOAT3& min, DirectX::XMFLOAT3& max) const;
+};